@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <type_traits>
+#include <vector>
+
+// Little helpers for the snapshot and replay formats. Values are written
+// as their raw bytes, so files only load on machines with the same
+// endianness and float layout, which is all we run on. Reads report
+// failure through the stream; callers check it once at the end.
+
+template <typename T> void write_value(std::ostream &out, const T &value) {
+  static_assert(std::is_trivially_copyable<T>::value, "raw bytes only");
+  out.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+template <typename T> void read_value(std::istream &in, T &value) {
+  static_assert(std::is_trivially_copyable<T>::value, "raw bytes only");
+  in.read(reinterpret_cast<char *>(&value), sizeof(T));
+}
+
+template <typename T>
+void write_vector(std::ostream &out, const std::vector<T> &values) {
+  static_assert(std::is_trivially_copyable<T>::value, "raw bytes only");
+  write_value(out, (uint64_t)values.size());
+  out.write(reinterpret_cast<const char *>(values.data()),
+            values.size() * sizeof(T));
+}
+
+// Bytes from the read position to the end of in, or 0 if in cannot seek.
+// Bounds sizes read from a file before anything is allocated for them.
+inline uint64_t bytes_left(std::istream &in) {
+  std::streampos here = in.tellg();
+  if (here < 0) {
+    return 0;
+  }
+  in.seekg(0, std::ios::end);
+  std::streampos end = in.tellg();
+  in.seekg(here);
+  return end > here ? (uint64_t)(end - here) : 0;
+}
+
+// Refuses sizes above max_size, so a corrupt file cannot make us
+// allocate gigabytes
+template <typename T>
+void read_vector(std::istream &in, std::vector<T> &values,
+                 uint64_t max_size) {
+  static_assert(std::is_trivially_copyable<T>::value, "raw bytes only");
+  uint64_t size = 0;
+  read_value(in, size);
+  if (!in || size > max_size) {
+    in.setstate(std::ios::failbit);
+    return;
+  }
+  values.resize(size);
+  in.read(reinterpret_cast<char *>(values.data()), size * sizeof(T));
+}
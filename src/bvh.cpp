@@ -0,0 +1,201 @@
+#include "bvh.h"
+
+#include <algorithm>
+
+void TriangleBVH::build(const std::vector<glm::vec3> &vertices,
+                        const std::vector<unsigned int> &triangle_indices) {
+  local = vertices;
+  world = vertices;
+  indices = triangle_indices;
+  indices.resize(indices.size() / 3 * 3);
+  order.resize(triangle_count());
+  std::vector<glm::vec3> centroids(triangle_count());
+  for (int t = 0; t < triangle_count(); t++) {
+    order[t] = t;
+    centroids[t] = (corner(t, 0) + corner(t, 1) + corner(t, 2)) / 3.0f;
+  }
+  nodes.clear();
+  if (order.empty()) {
+    return;
+  }
+  nodes.push_back({AABB(), 0, triangle_count()});
+  split(0, centroids);
+  refit(glm::mat4(1.0f));
+}
+
+// Splits the node at the median centroid along the longest axis of the
+// centroids' bounds until leaves are small
+void TriangleBVH::split(int node, std::vector<glm::vec3> &centroids) {
+  int first = nodes[node].first;
+  int count = nodes[node].count;
+  if (count <= kLeafSize) {
+    return;
+  }
+  AABB bounds;
+  for (int i = first; i < first + count; i++) {
+    bounds.grow(centroids[order[i]]);
+  }
+  glm::vec3 extent = bounds.max - bounds.min;
+  int axis = 0;
+  if (extent.y > extent[axis]) axis = 1;
+  if (extent.z > extent[axis]) axis = 2;
+  int half = count / 2;
+  std::nth_element(order.begin() + first, order.begin() + first + half,
+                   order.begin() + first + count, [&](int a, int b) {
+                     return centroids[a][axis] < centroids[b][axis];
+                   });
+
+  int children = (int)nodes.size();
+  nodes.push_back({AABB(), first, half});
+  nodes.push_back({AABB(), first + half, count - half});
+  nodes[node].first = children;
+  nodes[node].count = 0;
+  split(children, centroids);
+  split(children + 1, centroids);
+}
+
+AABB TriangleBVH::triangle_box(int t) const {
+  AABB box;
+  box.grow(corner(t, 0));
+  box.grow(corner(t, 1));
+  box.grow(corner(t, 2));
+  return box;
+}
+
+void TriangleBVH::refit(const glm::mat4 &transform) {
+  mirrored = glm::dot(glm::vec3(transform[0]),
+                      glm::cross(glm::vec3(transform[1]),
+                                 glm::vec3(transform[2]))) < 0.0f;
+  for (int i = 0; i < local.size(); i++) {
+    world[i] = glm::vec3(transform * glm::vec4(local[i], 1.0f));
+  }
+  for (int n = (int)nodes.size() - 1; n >= 0; n--) {
+    Node &node = nodes[n];
+    node.box = AABB();
+    if (node.count > 0) {
+      for (int i = node.first; i < node.first + node.count; i++) {
+        node.box.grow(triangle_box(order[i]));
+      }
+    } else {
+      node.box.grow(nodes[node.first].box);
+      node.box.grow(nodes[node.first + 1].box);
+    }
+  }
+}
+
+// Closest point to p on triangle abc (Ericson, Real-Time Collision
+// Detection 5.1.5)
+static glm::vec3 closest_on_triangle(const glm::vec3 &p, const glm::vec3 &a,
+                                     const glm::vec3 &b, const glm::vec3 &c) {
+  glm::vec3 ab = b - a;
+  glm::vec3 ac = c - a;
+  glm::vec3 ap = p - a;
+  float d1 = glm::dot(ab, ap);
+  float d2 = glm::dot(ac, ap);
+  if (d1 <= 0.0f && d2 <= 0.0f) {
+    return a;
+  }
+  glm::vec3 bp = p - b;
+  float d3 = glm::dot(ab, bp);
+  float d4 = glm::dot(ac, bp);
+  if (d3 >= 0.0f && d4 <= d3) {
+    return b;
+  }
+  float vc = d1 * d4 - d3 * d2;
+  if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) {
+    return a + ab * (d1 / (d1 - d3));
+  }
+  glm::vec3 cp = p - c;
+  float d5 = glm::dot(ab, cp);
+  float d6 = glm::dot(ac, cp);
+  if (d6 >= 0.0f && d5 <= d6) {
+    return c;
+  }
+  float vb = d5 * d2 - d1 * d6;
+  if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) {
+    return a + ac * (d2 / (d2 - d6));
+  }
+  float va = d3 * d6 - d5 * d4;
+  if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f) {
+    return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+  }
+  float denominator = 1.0f / (va + vb + vc);
+  return a + ab * (vb * denominator) + ac * (vc * denominator);
+}
+
+glm::vec3 TriangleBVH::outward(int t) const {
+  glm::vec3 n = glm::cross(corner(t, 1) - corner(t, 0),
+                           corner(t, 2) - corner(t, 0));
+  return mirrored ? -n : n;
+}
+
+// True if q, on the plane of triangle abc with n = (b - a) x (c - a),
+// lies inside it
+static bool inside_triangle(const glm::vec3 &q, const glm::vec3 &a,
+                            const glm::vec3 &b, const glm::vec3 &c,
+                            const glm::vec3 &n) {
+  return glm::dot(glm::cross(b - a, q - a), n) >= 0.0f &&
+         glm::dot(glm::cross(c - b, q - b), n) >= 0.0f &&
+         glm::dot(glm::cross(a - c, q - c), n) >= 0.0f;
+}
+
+void TriangleBVH::collide(const glm::vec3 &prev, glm::vec3 &p,
+                          float thickness) const {
+  // Stop the path at the first front face it crosses
+  AABB box;
+  box.grow(prev);
+  box.grow(p);
+  float first = 1.0f;
+  glm::vec3 first_normal;
+  query(box, [&](int t) {
+    const glm::vec3 &a = corner(t, 0);
+    glm::vec3 n = outward(t);
+    float start = glm::dot(prev - a, n);
+    float end = glm::dot(p - a, n);
+    if (start < 0.0f || end >= 0.0f) {
+      return;
+    }
+    float s = start / (start - end);
+    glm::vec3 q = prev + (p - prev) * s;
+    if (s < first &&
+        inside_triangle(q, a, corner(t, 1), corner(t, 2),
+                        mirrored ? -n : n)) {
+      first = s;
+      first_normal = glm::normalize(n);
+    }
+  });
+  if (first < 1.0f) {
+    p = prev + (p - prev) * first + thickness * first_normal;
+    return;
+  }
+
+  // Otherwise keep p thickness in front of the closest triangle. Points
+  // found behind it, pushed in by the constraints, are pulled back out
+  // as long as they are within reach.
+  float reach = 2.0f * thickness + glm::length(p - prev);
+  box = AABB();
+  box.grow(p);
+  box.min -= glm::vec3(reach);
+  box.max += glm::vec3(reach);
+  float closest = reach * reach;
+  glm::vec3 contact;
+  glm::vec3 normal;
+  query(box, [&](int t) {
+    glm::vec3 q = closest_on_triangle(p, corner(t, 0), corner(t, 1),
+                                      corner(t, 2));
+    float distance2 = glm::dot(p - q, p - q);
+    if (distance2 < closest) {
+      closest = distance2;
+      contact = q;
+      normal = outward(t);
+    }
+  });
+  if (closest == reach * reach || glm::dot(normal, normal) == 0.0f) {
+    return;
+  }
+  normal = glm::normalize(normal);
+  float depth = glm::dot(p - contact, normal);
+  if (depth < thickness) {
+    p += (thickness - depth) * normal;
+  }
+}
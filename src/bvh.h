@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cmath>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+struct AABB {
+  glm::vec3 min = glm::vec3(INFINITY);
+  glm::vec3 max = glm::vec3(-INFINITY);
+
+  void grow(const glm::vec3 &p) {
+    min = glm::min(min, p);
+    max = glm::max(max, p);
+  }
+  void grow(const AABB &b) {
+    min = glm::min(min, b.min);
+    max = glm::max(max, b.max);
+  }
+  bool overlaps(const AABB &b) const {
+    return min.x <= b.max.x && b.min.x <= max.x && min.y <= b.max.y &&
+           b.min.y <= max.y && min.z <= b.max.z && b.min.z <= max.z;
+  }
+};
+
+// Bounding volume hierarchy over a triangle mesh. The tree is built once
+// from the mesh in its own space; when the mesh moves, refit() transforms
+// the vertices and recomputes the boxes bottom-up without touching the
+// tree, which is much cheaper than a rebuild and stays tight enough for
+// rigid motion.
+class TriangleBVH {
+public:
+  void build(const std::vector<glm::vec3> &vertices,
+             const std::vector<unsigned int> &indices);
+  void refit(const glm::mat4 &transform);
+
+  int triangle_count() const { return (int)(indices.size() / 3); }
+  int node_count() const { return (int)nodes.size(); }
+  const AABB &bounds() const { return nodes[0].box; }
+  // Corner k of triangle t, as placed by the last refit()
+  const glm::vec3 &corner(int t, int k) const {
+    return world[indices[3 * t + k]];
+  }
+
+  // Calls fn(t) for every triangle t in the leaves whose box overlaps
+  // box. That includes every triangle overlapping box, plus some near
+  // misses that share a leaf with them.
+  template <typename F> void query(const AABB &box, F fn) const {
+    if (nodes.empty()) {
+      return;
+    }
+    int stack[64];
+    int size = 0;
+    stack[size++] = 0;
+    while (size > 0) {
+      const Node &node = nodes[stack[--size]];
+      if (!node.box.overlaps(box)) {
+        continue;
+      }
+      if (node.count > 0) {
+        for (int i = node.first; i < node.first + node.count; i++) {
+          fn(order[i]);
+        }
+      } else {
+        stack[size++] = node.first;
+        stack[size++] = node.first + 1;
+      }
+    }
+  }
+
+  // Keeps a particle that moved from prev to p at least thickness in front
+  // of the surface. Front faces are counter-clockwise, as Assimp loads
+  // them, and stay so under mirroring transforms. A path crossing a front
+  // face is stopped where it crosses, so fast particles cannot pass
+  // through thin parts of the mesh; a particle found just behind its
+  // closest face is pushed back out.
+  void collide(const glm::vec3 &prev, glm::vec3 &p, float thickness) const;
+
+private:
+  // Leaves hold count > 0 triangles starting at order[first]; inner nodes
+  // have count 0 and their children at first and first + 1, always after
+  // the parent, so a reverse sweep over nodes refits bottom-up.
+  struct Node {
+    AABB box;
+    int first;
+    int count;
+  };
+  static const int kLeafSize = 4;
+
+  std::vector<glm::vec3> local;
+  std::vector<glm::vec3> world;
+  std::vector<unsigned int> indices;
+  std::vector<int> order;
+  std::vector<Node> nodes;
+  bool mirrored = false;  // refit() transform flips handedness
+
+  void split(int node, std::vector<glm::vec3> &centroids);
+  AABB triangle_box(int t) const;
+  // Unnormalized normal of the front face of triangle t
+  glm::vec3 outward(int t) const;
+};
@@ -2,13 +2,19 @@
  * cloth.cpp
  */
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <iostream>
 #include <vector>
 #include <math.h>
 #include <glm/ext.hpp>
+#include "binary_io.h"
 #include "cloth.h"
 
 #define SQRT_2 1.4142135f
+#define SNAPSHOT_MAGIC "CLOTHSNP"
+#define SNAPSHOT_VERSION 1u
 
 
 Cloth::Cloth(int r, int c, int m, bool p)
@@ -19,6 +25,30 @@ Cloth::Cloth(int r, int c, int m, bool p)
     k = 2.0f;
     time = 0.0f;
     wind = false;
+    constraint_solver = GAUSS_SEIDEL;
+    spring_kernel = best_spring_kernel();
+    constraint_graph_valid = false;
+    compliance[STRUCTURAL] = 0.0f;
+    compliance[SHEAR] = 1e-4f;
+    compliance[BEND] = 1e-3f;
+    substeps = 10;
+    frame_timestep = 1.0f / 60.0f;
+    cg_iterations = 0;
+    generation = 0;
+    pool = nullptr;
+    compute_normals = false;
+    self_collision = false;
+    thickness = 0.5f * grid_size;
+    sleeping = false;
+    sleep_threshold = 1e-3f * grid_size;
+    sleep_steps = 30;
+    tile_rows = (r + SLEEP_TILE - 1) / SLEEP_TILE;
+    tile_cols = (c + SLEEP_TILE - 1) / SLEEP_TILE;
+    tile_quiet_steps.assign(tile_rows * tile_cols, 0);
+    tile_asleep.assign(tile_rows * tile_cols, 0);
+    tile_motion.assign(tile_rows * tile_cols, 0.0f);
+    point_asleep.assign(r * c, 0);
+    awake_lists_valid = false;
     
     // Vertices initialization
     for (int i=0; i<r; i++) {
@@ -32,20 +62,18 @@ Cloth::Cloth(int r, int c, int m, bool p)
                 y = grid_size * i;
                 z = 0.0f;
             }
-            Point* curr_point = new Point(x, y, z);
+            particles.add(glm::vec3(x, y, z));
 
             int current_index = i*c + j;
-            curr_point->set_index(current_index);
             if (current_index == 0 || current_index == col_count-1) {
-                curr_point->pined = true;
+                particles.pinned[current_index] = 1;
             }
             if (p){
                 if(current_index == (row_count-1)*col_count || 
                    current_index == vertex_count-1) {
-                    curr_point->pined = true;
+                    particles.pinned[current_index] = 1;
                 }
             }
-            points.push_back(curr_point);
         }
     }
 
@@ -70,25 +98,108 @@ Cloth::Cloth(int r, int c, int m, bool p)
     ball_center = glm::vec3(grid_size * c * 0.5f,
                             grid_size * r * 1.8f, 
                             ball_radius * 2);
+    colliders.add_sphere(ball_center, ball_radius);
+
+    // Springs initialization
+    build_springs();
 
     // Constaints initialization
-    if(mode == 1) {
+    if(mode == 1 || mode == 2) {
       get_constraints();
     }
 }
 
-std::vector<int> Cloth::get_indices() {
+Cloth::~Cloth() {
+}
+
+void Cloth::set_thread_count(int n) {
+    if (n <= 1) {
+        own_pool.reset();
+    } else if (!own_pool || own_pool->size() != n) {
+        own_pool.reset(new ThreadPool(n));
+    }
+    pool = own_pool.get();
+}
+
+void Cloth::set_thread_pool(ThreadPool *p) {
+    own_pool.reset();
+    pool = p;
+}
+
+int Cloth::get_thread_count() {
+    return pool ? pool->size() : 1;
+}
+
+/* Calls fn(first_vertex, last_vertex) over bands of whole rows, on the
+ * thread pool when there is one. Only the small forwarding lambdas are
+ * handed to parallel_for, which fit in std::function without allocating. */
+template <typename F> void Cloth::for_each_band(const F &fn) {
+    if (!pool) {
+        fn(0, vertex_count);
+        return;
+    }
+    pool->parallel_for(0, row_count, [&](int first_row, int last_row) {
+        fn(first_row * col_count, last_row * col_count);
+    });
+}
+
+template <typename F> void Cloth::for_each_range(int begin, int end,
+                                                 const F &fn) {
+    if (!pool) {
+        fn(begin, end);
+        return;
+    }
+    pool->parallel_for(begin, end, [&fn](int first, int last) {
+        fn(first, last);
+    });
+}
+
+/* Like for_each_band, but only over the points of awake tiles when
+ * sleeping is on */
+template <typename F> void Cloth::for_each_awake(const F &fn) {
+    if (!sleeping) {
+        for_each_band(fn);
+        return;
+    }
+    for_each_range(0, awake_spans.size() / 2, [&](int first, int last) {
+        for (int i=first; i<last; i++) {
+            fn(awake_spans[2*i], awake_spans[2*i+1]);
+        }
+    });
+}
+
+const std::vector<int> &Cloth::get_indices() const {
     return indices;
 }
 
-std::vector<float> Cloth::get_vertices() {
-    std::vector<float> vertices;
-    for (int i=0; i<vertex_count; i++) {
-        vertices.push_back(points[i]->pos.x);
-        vertices.push_back(points[i]->pos.y);
-        vertices.push_back(points[i]->pos.z);
+absl::Span<const float> Cloth::get_positions() const {
+    static_assert(sizeof(glm::vec3) == 3 * sizeof(float),
+                  "positions must be tightly packed x/y/z floats");
+    return absl::Span<const float>(
+        reinterpret_cast<const float *>(particles.pos.data()),
+        particles.pos.size() * 3);
+}
+
+uint64_t Cloth::get_generation() const {
+    return generation;
+}
+
+void Cloth::set_compute_normals(bool on) {
+    if (on && !compute_normals) {
+        compute_normals = true;
+        update_normals();
     }
-    return vertices;
+    compute_normals = on;
+}
+
+bool Cloth::get_compute_normals() {
+    return compute_normals;
+}
+
+absl::Span<const float> Cloth::get_normals() const {
+    return absl::Span<const float>(
+        reinterpret_cast<const float *>(particles.normal.data()),
+        particles.normal.size() * 3);
 }
 
 float Cloth::get_grid_size() {
@@ -103,85 +214,106 @@ int Cloth::get_col_count() {
     return col_count;
 }
 
-bool Cloth::update_points(std::vector<float> &vertices) {
-    glm::vec3 force;  // Fcrce on each point
+bool Cloth::update_points() {
     glm::vec3 gravity;  // The gravity vector
     float vertex_mass = mass / vertex_count;  // Mass of each vertex
     float timestep = 0.0001f;  // Timestep
     float damping = 0.01f;  // Damping (air resistance)
-    glm::vec3 wind_force = glm::vec3(0);
     gravity = 0.1f * glm::vec3(0, 9.8f, 0);
+    std::vector<glm::vec3> &pos = particles.pos;
+    std::vector<glm::vec3> &old_pos = particles.old_pos;
+    std::vector<glm::vec3> &acc = particles.acc;
+    std::vector<unsigned char> &pinned = particles.pinned;
     
-    for (int i=0; i<vertex_count; i++) {
-        Point* curr_point = points[i];
-        // Force initialization (gravity)
-        curr_point->force += vertex_mass * gravity;         
-        /* Get the neighbors on straight directions 
-         * (up/down/left/right) */
-        std::vector<int> s_neighbors = curr_point->get_s_neighbors(i, col_count, 
-                                                                   row_count);
-        /* Get the neighbors on diagonal directions 
-         * (up_left/up_right/down_left/down_right) */
-        std::vector<int> d_neighbors = curr_point->get_d_neighbors(i, col_count, 
-                                                                   row_count);    
-        // Spring force accumulation 
-        for (int j=0; j<s_neighbors.size(); j++) {
-            Point* neighbor_point = points[s_neighbors[j]];
-            glm::vec3 x = neighbor_point->pos - curr_point->pos;
-            curr_point->force += glm::normalize(x) 
-                                 * (glm::length(x) - grid_size) 
-                                 * k; 
-        }
-        for (int j=0; j<d_neighbors.size(); j++) {
-            Point* neighbor_point = points[d_neighbors[j]];
-            glm::vec3 x = neighbor_point->pos - curr_point->pos;
-            curr_point->force += glm::normalize(x) 
-                                 * (glm::length(x) - grid_size * SQRT_2) 
-                                 * k;
+    soa_x.resize(vertex_count);
+    soa_y.resize(vertex_count);
+    soa_z.resize(vertex_count);
+    spring_fx.resize(vertex_count);
+    spring_fy.resize(vertex_count);
+    spring_fz.resize(vertex_count);
+
+    /* Split the positions into x/y/z so the spring kernel can work on
+     * whole rows at once */
+    for_each_band([&](int first, int last) {
+        for (int i=first; i<last; i++) {
+            soa_x[i] = pos[i].x;
+            soa_y[i] = pos[i].y;
+            soa_z[i] = pos[i].z;
         }
+    });
 
-        /* Add wind force */
-        float x_force = 0; // cos(0.8f*time) * (rand()/RAND_MAX-0.5f);
-        float y_force = std::abs(sin(0.1f*time) - 0.2f);
-        float z_force = std::abs(cos(sin(curr_point->pos[0]*time) - 0.8f));
-        if (wind) {
-            wind_force = glm::vec3(x_force, 
-                                   -0.0005f * y_force, 
-                                   -0.002f * z_force);
-            curr_point->force += wind_force;
+    /* Force accumulation. Each row only gathers from its neighbors
+     * and writes its own accelerations, so bands can run in parallel. */
+    for_each_band([&](int first, int last) {
+        glm::vec3 force;  // Fcrce on each point
+        glm::vec3 wind_force = glm::vec3(0);
+        // Spring force accumulation 
+        for (int row=first/col_count; row<last/col_count; row++) {
+            int offset = row * col_count;
+            spring_row_forces(spring_kernel, soa_x.data(), soa_y.data(), 
+                              soa_z.data(), row_count, col_count, row, 
+                              grid_size, grid_size * SQRT_2, k, 
+                              &spring_fx[offset], &spring_fy[offset], 
+                              &spring_fz[offset]);
         }
+        for (int i=first; i<last; i++) {
+            // Force initialization (gravity and springs)
+            force = vertex_mass * gravity 
+                    + glm::vec3(spring_fx[i], spring_fy[i], spring_fz[i]);
 
-        /* Set the velocity of each point */
-        curr_point->set_acc(curr_point->force / vertex_mass);
+            /* Add wind force */
+            if (wind) {
+                float x_force = 0; // cos(0.8f*time) * (rand()/RAND_MAX-0.5f);
+                float y_force = std::abs(sin(0.1f*time) - 0.2f);
+                float z_force = std::abs(cos(sin(pos[i][0]*time) - 0.8f));
+                wind_force = glm::vec3(x_force, 
+                                       -0.0005f * y_force, 
+                                       -0.002f * z_force);
+                force += wind_force;
+            }
 
-        /* Reset force */
-        curr_point->force = glm::vec3(0);
-    }
+            /* Set the acceleration of each point */
+            acc[i] = force / vertex_mass;
+        }
+    });
 
     /* Position update and Object collision */
-    for (int i=0; i<vertex_count; i++) {
-        glm::vec3 temp = points[i]->pos;
-        if(!points[i]->pined) {
-            points[i]->pos = points[i]->pos + (1.0f - damping) 
-                             * (points[i]->pos - points[i]->old_pos)
-                             + points[i]->get_acc()*timestep;
-            glm::vec3 offset = points[i]->pos - ball_center;
-            if (glm::length(offset) < ball_radius) {
-                points[i]->pos += glm::normalize(offset) 
-                                  * (ball_radius - glm::length(offset));
+    for_each_band([&](int first, int last) {
+        for (int i=first; i<last; i++) {
+            glm::vec3 temp = pos[i];
+            if(!pinned[i]) {
+                pos[i] = pos[i] + (1.0f - damping) * (pos[i] - old_pos[i])
+                         + acc[i]*timestep;
+                colliders.collide(temp, pos[i], 0.0f, 1.0f);
             }
-                
+            old_pos[i] = temp;
         }
-        points[i]->old_pos = temp;
-        vertices[i*3] = points[i]->pos.x;
-        vertices[i*3+1] = points[i]->pos.y;
-        vertices[i*3+2] = points[i]->pos.z;
-    }
+    });
+
+    if (self_collision) collide_self();
+
+    if (compute_normals) update_normals();
+    colliders.end_step();
     time += 0.03f;
+    generation++;
     return true;
 }
 
+bool Cloth::update() {
+    switch (mode) {
+        case 0:
+            return update_points();
+        case 1:
+            return update_points_constraint();
+        case 2:
+            return update_points_xpbd();
+        default:
+            return update_points_implicit();
+    }
+}
+
 void Cloth::wind_on() {
+    wake();
     if (wind) {
         wind = false;
         std::cout << "Wind mode off" << std::endl;
@@ -192,6 +324,15 @@ void Cloth::wind_on() {
     }
 }
 
+void Cloth::set_wind(bool on) {
+    if (on != wind) wake();
+    wind = on;
+}
+
+bool Cloth::get_wind() {
+    return wind;
+}
+
 void Cloth::add_k() {
     if (k < 4.7f) k += 0.1f;
     std::cout << "Current k: " << k << std::endl;
@@ -202,183 +343,884 @@ void Cloth::reduce_k() {
     std::cout << "Current k: " << k << std::endl;
 }
 
-void Cloth::ball_control(char input) {
+void apply_ball_control(char input, glm::vec3 &center, float &radius) {
     switch(input) {
         case 'I':
-            ball_center -= glm::vec3(0, 0.004f, 0);
+            center -= glm::vec3(0, 0.004f, 0);
             break;
         case 'K':
-            ball_center += glm::vec3(0, 0.004f, 0);
+            center += glm::vec3(0, 0.004f, 0);
             break;
         case 'J':
-            ball_center -= glm::vec3(0.004f, 0, 0);
+            center -= glm::vec3(0.004f, 0, 0);
             break;
         case 'L':
-            ball_center += glm::vec3(0.004f, 0, 0);
+            center += glm::vec3(0.004f, 0, 0);
             break;
         case 'U':
-            ball_center -= glm::vec3(0, 0, 0.004f);
+            center -= glm::vec3(0, 0, 0.004f);
             break;
         case 'O':
-            ball_center += glm::vec3(0, 0, 0.004f);
+            center += glm::vec3(0, 0, 0.004f);
             break;
         case '[':
-            if(ball_radius > 0.2f) ball_radius -= 0.002f;
+            if(radius > 0.2f) radius -= 0.002f;
             break;
         case ']':
-            if(ball_radius < 4.0f) ball_radius += 0.002f;
+            if(radius < 4.0f) radius += 0.002f;
             break;
     }
 }
 
-bool Cloth::update_points_constraint(std::vector<float> &vertices) {
-    glm::vec3 force;  // Force on each point
+void Cloth::ball_control(char input) {
+    apply_ball_control(input, ball_center, ball_radius);
+    colliders.move_sphere(0, ball_center, ball_radius);
+}
+
+bool Cloth::update_points_constraint() {
     glm::vec3 gravity;  // The gravity vector
     float vertex_mass = mass / vertex_count;  // Mass of each vertex
     float timestep = 0.00015f;  // Timestep
     float damping = 0.02f;  // Damping (air resistance)
-    glm::vec3 wind_force = glm::vec3(0);
     gravity = 0.1f * glm::vec3(0, 9.8f, 0);
+    std::vector<glm::vec3> &pos = particles.pos;
+    std::vector<glm::vec3> &old_pos = particles.old_pos;
+    std::vector<glm::vec3> &acc = particles.acc;
+    std::vector<unsigned char> &pinned = particles.pinned;
+
+    if (constraint_solver != GAUSS_SEIDEL && !constraint_graph_valid) {
+        build_constraint_graph();
+    }
+    if (sleeping) {
+        wake_near_colliders();
+        if (!awake_lists_valid) build_awake_lists();
+    }
     
-    for (int i=0; i<vertex_count; i++) {
-        Point* curr_point = points[i];
-        curr_point->force += vertex_mass * gravity; // Force initialization (gravity)
+    for_each_awake([&](int first, int last) {
+        glm::vec3 force;  // Force on each point
+        glm::vec3 wind_force = glm::vec3(0);
+        for (int i=first; i<last; i++) {
+            force = vertex_mass * gravity; // Force initialization (gravity)
+
+            /* Add wind force */
+            if (wind) {
+                float x_force = 0;
+                float y_force = std::abs(sin(0.1f*time) - 0.2f);
+                float z_force = std::abs(cos(sin(pos[i][0]*time) - 0.8f));
+                wind_force = glm::vec3(x_force, -0.0005f * y_force, 
+                                       -0.002f * z_force);
+                force += wind_force;
+            }
 
-        /* Add wind force */
-        float x_force = 0;
-        float y_force = std::abs(sin(0.1f*time) - 0.2f);
-        float z_force = std::abs(cos(sin(curr_point->pos[0]*time) - 0.8f));
-        if (wind) {
-            wind_force = glm::vec3(x_force, -0.0005f * y_force, -0.002f * z_force);
-            curr_point->force += wind_force;
+            /* Set the acceleration of each point */
+            acc[i] = force / vertex_mass;
         }
+    });
 
-        /* Set the velocity of each point */
-        curr_point->set_acc(curr_point->force / vertex_mass);
+    /* Position update and Object collision */
+    for_each_awake([&](int first, int last) {
+        for (int i=first; i<last; i++) {
+            glm::vec3 temp = pos[i];
+            if(!pinned[i]) {
+                pos[i] = pos[i] + (1.0f - damping) * (pos[i] - old_pos[i])
+                         + acc[i]*timestep;
+                colliders.collide(temp, pos[i], 0.0f, 1.0f);
+            }
+            old_pos[i] = temp;
+        }
+    });
 
-        /* Reset force */
-        curr_point->force = glm::vec3(0);
+    /* Satisfy constraint. Sleeping points hold still like pinned ones. */
+    int constraint_count = sleeping ? awake_constraints.size() 
+                                    : constraints.size();
+    for (int j=0; j<10; j++) {
+        if (constraint_solver == GRAPH_COLORED) {
+            project_colored();
+        } else if (constraint_solver == JACOBI) {
+            project_jacobi();
+        } else {
+            for (int n=0; n<constraint_count; n++) {
+                Constraint &it = constraints[sleeping ? awake_constraints[n] 
+                                                      : n];
+                if (it.torn) continue;
+                glm::vec3 &a = pos[it.a];
+                glm::vec3 &b = pos[it.b];
+                float rest_distance = it.rest_distance;
+                float distance = glm::length(a - b);
+                if (distance > rest_distance) {
+                    float offset = (distance - rest_distance) / distance;
+                    glm::vec3 correction = 0.5f * offset * (a - b);
+                    if(!pinned[it.a] && !point_asleep[it.a])
+                        a -= correction;
+                    if(!pinned[it.b] && !point_asleep[it.b])
+                        b += correction;
+                }
+
+                /* Torn constraints are only marked here and dropped in
+                 * one pass once the iterations are done */
+                float tear_distance = it.rest_distance * 3.0f;
+                if (distance > tear_distance) {
+                    pinned[it.a] = 0;
+                    pinned[it.b] = 0;
+                    it.torn = true;
+                }
+            }
+        }
     }
+    remove_torn_constraints();
+    if (self_collision) collide_self();
+    if (sleeping) update_sleep_state();
+
+    if (compute_normals) update_normals();
+    colliders.end_step();
+    time += 0.03f;
+    generation++;
+    
+    return true;
+}
+
+void Cloth::build_springs() {
+    spring_offsets.clear();
+    spring_neighbors.clear();
+    spring_rest.clear();
+    spring_offsets.reserve(vertex_count + 1);
+    spring_neighbors.reserve(vertex_count * 8);
+    spring_rest.reserve(vertex_count * 8);
 
-    /* Position update and Object collision */
     for (int i=0; i<vertex_count; i++) {
-        glm::vec3 temp = points[i]->pos;
-        if(!points[i]->pined) {
-            points[i]->pos = points[i]->pos + (1.0f - damping) 
-                             * (points[i]->pos - points[i]->old_pos)
-                             + points[i]->get_acc()*timestep;
-            glm::vec3 offset = points[i]->pos - ball_center;
-            if (glm::length(offset) < ball_radius) {
-                points[i]->pos += (
-                    glm::normalize(offset) * 
-                    (ball_radius - glm::length(offset))
-                );
+        spring_offsets.push_back(spring_neighbors.size());
+        /* Neighbors on straight directions 
+         * (up/down/left/right) */
+        for (int n : Point::get_s_neighbors(i, col_count, row_count)) {
+            spring_neighbors.push_back(n);
+            spring_rest.push_back(grid_size);
+        }
+        /* Neighbors on diagonal directions 
+         * (up_left/down_right/up_right/down_left) */
+        for (int n : Point::get_d_neighbors(i, col_count, row_count)) {
+            spring_neighbors.push_back(n);
+            spring_rest.push_back(grid_size * SQRT_2);
+        }
+    }
+    spring_offsets.push_back(spring_neighbors.size());
+}
+
+/* Extended position based dynamics (XPBD) with small steps: each frame is
+ * split into substeps, each doing one prediction and one constraint
+ * sweep. Stiffness comes from the per-type compliance rather than the
+ * iteration count, so it does not change with substeps or frame rate. */
+bool Cloth::update_points_xpbd() {
+    glm::vec3 gravity = glm::vec3(0, 9.8f, 0);  // The gravity vector
+    float vertex_mass = mass / vertex_count;  // Mass of each vertex
+    float damping = 1.0f;  // Velocity lost to air resistance, per second
+    float dt = frame_timestep / substeps;  // Substep length
+    float drag = std::max(0.0f, 1.0f - damping * dt);
+    std::vector<glm::vec3> &pos = particles.pos;
+    std::vector<glm::vec3> &old_pos = particles.old_pos;
+    std::vector<glm::vec3> &acc = particles.acc;
+    std::vector<unsigned char> &pinned = particles.pinned;
+
+    if (constraint_solver != GAUSS_SEIDEL && !constraint_graph_valid) {
+        build_constraint_graph();
+    }
+
+    for (int step=0; step<substeps; step++) {
+        /* Prediction from external forces and Object collision */
+        for_each_band([&](int first, int last) {
+            for (int i=first; i<last; i++) {
+                glm::vec3 force = vertex_mass * gravity;
+                if (wind) {
+                    float y_force = std::abs(sin(0.1f*time) - 0.2f);
+                    float z_force = std::abs(cos(sin(pos[i][0]*time) - 0.8f));
+                    force += glm::vec3(0, -0.0005f * y_force, 
+                                       -0.002f * z_force);
+                }
+                acc[i] = force / vertex_mass;
+
+                glm::vec3 temp = pos[i];
+                if(!pinned[i]) {
+                    pos[i] = pos[i] + drag * (pos[i] - old_pos[i])
+                             + acc[i]*dt*dt;
+                    colliders.collide(temp, pos[i], 
+                                      (float)step / substeps,
+                                      (float)(step + 1) / substeps);
+                }
+                old_pos[i] = temp;
+            }
+        });
+
+        project_xpbd(dt);
+        if (self_collision) collide_self();
+    }
+    remove_torn_constraints();
+
+    if (compute_normals) update_normals();
+    colliders.end_step();
+    /* The wind clock follows simulated time, at the 0.03 per frame the
+     * other modes use at 60 frames a second */
+    time += 0.03f * 60.0f * frame_timestep;
+    generation++;
+
+    return true;
+}
+
+/* Backward Euler on the same springs as update_points, but stable with
+ * a whole frame_timestep per step. The spring Jacobian is assembled from
+ * the precomputed spring topology and solved with preconditioned
+ * conjugate gradient (see ImplicitSolver). */
+bool Cloth::update_points_implicit() {
+    glm::vec3 gravity = 0.1f * glm::vec3(0, 9.8f, 0);  // The gravity vector
+    float vertex_mass = mass / vertex_count;  // Mass of each vertex
+    float h = frame_timestep;  // Timestep
+    float damping = 1.0f;  // Velocity lost to air resistance, per second
+    float drag = std::max(0.0f, 1.0f - damping * h);
+    std::vector<glm::vec3> &pos = particles.pos;
+    std::vector<glm::vec3> &old_pos = particles.old_pos;
+    std::vector<unsigned char> &pinned = particles.pinned;
+
+    velocity.resize(vertex_count);
+    external_force.resize(vertex_count);
+
+    /* Velocities from the last step and external forces */
+    for_each_band([&](int first, int last) {
+        for (int i=first; i<last; i++) {
+            velocity[i] = pinned[i] ? glm::vec3(0) : (pos[i] - old_pos[i]) / h;
+            glm::vec3 force = vertex_mass * gravity;
+            if (wind) {
+                float y_force = std::abs(sin(0.1f*time) - 0.2f);
+                float z_force = std::abs(cos(sin(pos[i][0]*time) - 0.8f));
+                force += glm::vec3(0, -0.0005f * y_force, -0.002f * z_force);
             }
-                
+            external_force[i] = force;
         }
-        points[i]->old_pos = temp;
+    });
+
+    SpringSystem system;
+    system.count = vertex_count;
+    system.pos = pos.data();
+    system.vel = velocity.data();
+    system.external_force = external_force.data();
+    system.pinned = pinned.data();
+    system.offsets = spring_offsets.data();
+    system.neighbors = spring_neighbors.data();
+    system.rest = spring_rest.data();
+    system.vertex_mass = vertex_mass;
+    system.k = k;
+    cg_iterations = implicit_solver.solve(system, h, pool, 
+                                          velocity_change);
+
+    /* Position update and Object collision */
+    for_each_band([&](int first, int last) {
+        for (int i=first; i<last; i++) {
+            old_pos[i] = pos[i];
+            if(!pinned[i]) {
+                pos[i] += h * drag * (velocity[i] + velocity_change[i]);
+                colliders.collide(old_pos[i], pos[i], 0.0f, 1.0f);
+            }
+        }
+    });
+
+    if (self_collision) collide_self();
+
+    if (compute_normals) update_normals();
+    colliders.end_step();
+    time += 0.03f;
+    generation++;
+
+    return true;
+}
+
+/* One XPBD sweep over the constraints. With a single sweep per substep
+ * the Lagrange multipliers start at zero every time, so
+ * delta_lambda = -C / (w_a + w_b + compliance / dt^2).
+ * Gauss-Seidel goes in construction order; the other solvers go color
+ * by color in parallel. */
+void Cloth::project_xpbd(float dt) {
+    std::vector<glm::vec3> &pos = particles.pos;
+    std::vector<unsigned char> &pinned = particles.pinned;
+    float w = vertex_count / mass;  // Inverse mass of each vertex
+    float alpha[CONSTRAINT_TYPE_COUNT];
+    for (int t=0; t<CONSTRAINT_TYPE_COUNT; t++) {
+        alpha[t] = compliance[t] / (dt * dt);
     }
 
-    /* Satisfy constraint */
-    for (int j=0; j<10; j++) {
+    auto project = [&](Constraint &it) {
+        if (it.torn) return;
+        glm::vec3 &a = pos[it.a];
+        glm::vec3 &b = pos[it.b];
+        glm::vec3 d = a - b;
+        float distance = glm::length(d);
+        float w_a = pinned[it.a] ? 0.0f : w;
+        float w_b = pinned[it.b] ? 0.0f : w;
+        float w_sum = w_a + w_b + alpha[it.type];
+        if (distance > it.rest_distance && w_sum > 0.0f) {
+            float lambda = -(distance - it.rest_distance) / w_sum;
+            glm::vec3 n = d / distance;
+            a += w_a * lambda * n;
+            b -= w_b * lambda * n;
+        }
+        if (distance > it.rest_distance * 3.0f) {
+            pinned[it.a] = 0;
+            pinned[it.b] = 0;
+            it.torn = true;
+        }
+    };
+
+    if (constraint_solver == GAUSS_SEIDEL) {
         for (int i=0; i<constraints.size(); i++) {
-            Constraint* it = constraints[i];
-            Point* a = points[it->a];
-            Point* b = points[it->b];
-            //std::cout << it->a << "," << it->b << std::endl;
-            //getchar();
-            float rest_distance = it->rest_distance;
-            float distance = glm::length(a->pos - b->pos);
+            project(constraints[i]);
+        }
+        return;
+    }
+    for (int c=0; c+1<color_offsets.size(); c++) {
+        for_each_range(color_offsets[c], color_offsets[c+1], 
+                       [&](int first, int last) {
+            for (int i=first; i<last; i++) {
+                project(constraints[colored_constraints[i]]);
+            }
+        });
+    }
+}
+
+int Cloth::get_cg_iterations() {
+    return cg_iterations;
+}
+
+void Cloth::set_self_collision(bool on) {
+    self_collision = on;
+}
+
+bool Cloth::get_self_collision() {
+    return self_collision;
+}
+
+void Cloth::set_thickness(float t) {
+    if (t > 0.0f) thickness = std::min(t, 0.9f * grid_size);
+}
+
+float Cloth::get_thickness() {
+    return thickness;
+}
+
+void Cloth::set_compliance(ConstraintType type, float c) {
+    compliance[type] = std::max(0.0f, c);
+}
+
+float Cloth::get_compliance(ConstraintType type) {
+    return compliance[type];
+}
+
+void Cloth::set_substeps(int n) {
+    substeps = std::max(1, n);
+}
+
+int Cloth::get_substeps() {
+    return substeps;
+}
+
+void Cloth::set_frame_timestep(float dt) {
+    if (dt > 0.0f) frame_timestep = dt;
+}
+
+float Cloth::get_frame_timestep() {
+    return frame_timestep;
+}
+
+void Cloth::set_constraint_solver(ConstraintSolver s) {
+    constraint_solver = s;
+    /* The awake lists only hold colors while the graph is in use */
+    awake_lists_valid = false;
+}
+
+Cloth::ConstraintSolver Cloth::get_constraint_solver() {
+    return constraint_solver;
+}
+
+int Cloth::get_color_count() {
+    if (!constraint_graph_valid) {
+        build_constraint_graph();
+    }
+    return (int)color_offsets.size() - 1;
+}
+
+absl::Span<const int> Cloth::get_color(int c) {
+    if (!constraint_graph_valid) {
+        build_constraint_graph();
+    }
+    return absl::Span<const int>(colored_constraints.data() + color_offsets[c],
+                                 color_offsets[c+1] - color_offsets[c]);
+}
+
+void Cloth::set_spring_kernel(SpringKernel kernel) {
+    if (spring_kernel_supported(kernel)) {
+        spring_kernel = kernel;
+    }
+}
+
+SpringKernel Cloth::get_spring_kernel() {
+    return spring_kernel;
+}
+
+int Cloth::get_constraint_count() {
+    return constraints.size();
+}
+
+const Constraint &Cloth::get_constraint(int i) const {
+    return constraints[i];
+}
+
+void Cloth::build_constraint_graph() {
+    int constraint_count = constraints.size();
+
+    /* Greedy coloring: every constraint takes the lowest color that
+     * neither of its points is already part of. A grid point belongs to
+     * at most 16 constraints, so 31 colors always suffice. */
+    std::vector<unsigned long long> used_colors(vertex_count, 0);
+    std::vector<int> color(constraint_count);
+    std::vector<int> color_count;
+    for (int i=0; i<constraint_count; i++) {
+        const Constraint &it = constraints[i];
+        unsigned long long used = used_colors[it.a] | used_colors[it.b];
+        int c = 0;
+        while (used & (1ull << c)) c++;
+        used_colors[it.a] |= 1ull << c;
+        used_colors[it.b] |= 1ull << c;
+        color[i] = c;
+        if (c >= color_count.size()) color_count.resize(c + 1, 0);
+        color_count[c]++;
+    }
+
+    /* Group the constraints by color, keeping their order in each color */
+    color_offsets.assign(color_count.size() + 1, 0);
+    for (int c=0; c<color_count.size(); c++) {
+        color_offsets[c+1] = color_offsets[c] + color_count[c];
+    }
+    std::vector<int> fill(color_offsets.begin(), color_offsets.end() - 1);
+    colored_constraints.resize(constraint_count);
+    for (int i=0; i<constraint_count; i++) {
+        colored_constraints[fill[color[i]]++] = i;
+    }
+
+    /* Constraints touching each point */
+    point_constraint_offsets.assign(vertex_count + 1, 0);
+    for (int i=0; i<constraint_count; i++) {
+        point_constraint_offsets[constraints[i].a + 1]++;
+        point_constraint_offsets[constraints[i].b + 1]++;
+    }
+    for (int i=0; i<vertex_count; i++) {
+        point_constraint_offsets[i+1] += point_constraint_offsets[i];
+    }
+    fill.assign(point_constraint_offsets.begin(), 
+                point_constraint_offsets.end() - 1);
+    point_constraints.resize(constraint_count * 2);
+    for (int i=0; i<constraint_count; i++) {
+        point_constraints[fill[constraints[i].a]++] = i * 2;
+        point_constraints[fill[constraints[i].b]++] = i * 2 + 1;
+    }
+    corrections.resize(constraint_count);
+
+    constraint_graph_valid = true;
+    awake_lists_valid = false;
+}
+
+/* One Gauss-Seidel sweep, color by color. Constraints of one color share
+ * no point, so each color is projected in parallel. */
+void Cloth::project_colored() {
+    std::vector<glm::vec3> &pos = particles.pos;
+    std::vector<unsigned char> &pinned = particles.pinned;
+    std::vector<int> &order = sleeping ? awake_colored : colored_constraints;
+    std::vector<int> &offsets = sleeping ? awake_color_offsets 
+                                         : color_offsets;
+    for (int c=0; c+1<offsets.size(); c++) {
+        for_each_range(offsets[c], offsets[c+1], [&](int first, int last) {
+            for (int i=first; i<last; i++) {
+                Constraint &it = constraints[order[i]];
+                if (it.torn) continue;
+                glm::vec3 &a = pos[it.a];
+                glm::vec3 &b = pos[it.b];
+                float rest_distance = it.rest_distance;
+                float distance = glm::length(a - b);
+                if (distance > rest_distance) {
+                    float offset = (distance - rest_distance) / distance;
+                    glm::vec3 correction = 0.5f * offset * (a - b);
+                    if(!pinned[it.a] && !point_asleep[it.a])
+                        a -= correction;
+                    if(!pinned[it.b] && !point_asleep[it.b])
+                        b += correction;
+                }
+
+                float tear_distance = it.rest_distance * 3.0f;
+                if (distance > tear_distance) {
+                    pinned[it.a] = 0;
+                    pinned[it.b] = 0;
+                    it.torn = true;
+                }
+            }
+        });
+    }
+}
+
+/* One Jacobi sweep: every constraint computes its correction from the
+ * same positions, then each point moves by the average of the
+ * corrections of its constraints. Slower to converge than Gauss-Seidel
+ * but needs no coloring. */
+void Cloth::project_jacobi() {
+    std::vector<glm::vec3> &pos = particles.pos;
+    std::vector<unsigned char> &pinned = particles.pinned;
+
+    int constraint_count = sleeping ? awake_constraints.size() 
+                                    : constraints.size();
+    for_each_range(0, constraint_count, [&](int first, int last) {
+        for (int n=first; n<last; n++) {
+            int i = sleeping ? awake_constraints[n] : n;
+            Constraint &it = constraints[i];
+            corrections[i] = glm::vec3(0);
+            if (it.torn) continue;
+            glm::vec3 d = pos[it.a] - pos[it.b];
+            float rest_distance = it.rest_distance;
+            float distance = glm::length(d);
             if (distance > rest_distance) {
                 float offset = (distance - rest_distance) / distance;
-                glm::vec3 correction = 0.5f * offset * (a->pos - b->pos);
-                if(!points[it->a]->pined)
-                    a->pos -= correction;
-                if(!points[it->b]->pined)
-                    b->pos += correction;
+                corrections[i] = 0.5f * offset * d;
             }
+            if (distance > rest_distance * 3.0f) {
+                it.torn = true;
+            }
+        }
+    });
 
-            float tear_distance = it->rest_distance * 3.0f;
-            if (distance > tear_distance) {
-                float offset = (distance - rest_distance) / distance;
-                glm::vec3 correction = offset * (a->pos - b->pos);
-                if (points[it->a]->pined) points[it->a]->pined = false;
-                if (points[it->b]->pined) points[it->b]->pined = false;
-                constraints.erase(constraints.begin() + i);
+    for_each_awake([&](int first, int last) {
+        for (int i=first; i<last; i++) {
+            glm::vec3 sum = glm::vec3(0);
+            int count = 0;
+            bool torn = false;
+            for (int j=point_constraint_offsets[i]; 
+                 j<point_constraint_offsets[i+1]; j++) {
+                int c = point_constraints[j] >> 1;
+                bool side_b = point_constraints[j] & 1;
+                if (corrections[c] != glm::vec3(0)) {
+                    sum += side_b ? corrections[c] : -corrections[c];
+                    count++;
+                }
+                torn = torn || constraints[c].torn;
+            }
+            if (count > 0 && !pinned[i]) {
+                pos[i] += sum / (float)count;
+            }
+            if (torn) {
+                pinned[i] = 0;
+            }
+        }
+    });
+}
+
+/* One Jacobi pass of point-point contact. Points closer than thickness
+ * are pushed apart along the line between them, half of the overlap
+ * each (all of it when the other one is pinned). Candidates come from a
+ * spatial hash with thickness-sized cells, so the pass is linear in the
+ * number of points; both the hash and the gather run over row bands. */
+void Cloth::collide_self() {
+    std::vector<glm::vec3> &pos = particles.pos;
+    std::vector<unsigned char> &pinned = particles.pinned;
+
+    spatial_hash.set_spacing(thickness);
+    spatial_hash.build(pos.data(), vertex_count, pool);
+    collision_pos.resize(vertex_count);
+
+    for_each_band([&](int first, int last) {
+        for (int i=first; i<last; i++) {
+            glm::vec3 p = pos[i];
+            glm::vec3 sum = glm::vec3(0);
+            if (!pinned[i]) {
+                spatial_hash.query(p, [&](int j) {
+                    if (j == i) return;
+                    glm::vec3 d = p - pos[j];
+                    float distance = glm::length(d);
+                    if (distance >= thickness || distance == 0.0f) return;
+                    float share = pinned[j] ? 1.0f : 0.5f;
+                    sum += share * (thickness - distance) / distance * d;
+                });
+            }
+            collision_pos[i] = p + sum;
+        }
+    });
+    for_each_band([&](int first, int last) {
+        std::copy(collision_pos.begin() + first, collision_pos.begin() + last,
+                  pos.begin() + first);
+    });
+}
+
+/* Normals straight from the grid: the cross product of the central
+ * differences along the row and along the column (one-sided on the
+ * border). Same orientation as the first triangle of every grid cell.
+ * Each point only reads its four neighbors, so rows run in parallel. */
+void Cloth::update_normals() {
+    std::vector<glm::vec3> &pos = particles.pos;
+    std::vector<glm::vec3> &normal = particles.normal;
+    for_each_band([&](int first, int last) {
+        for (int row=first/col_count; row<last/col_count; row++) {
+            int up = row > 0 ? row - 1 : row;
+            int down = row < row_count-1 ? row + 1 : row;
+            for (int col=0; col<col_count; col++) {
+                int left = col > 0 ? col - 1 : col;
+                int right = col < col_count-1 ? col + 1 : col;
+                glm::vec3 along_row = pos[row*col_count + right] 
+                                      - pos[row*col_count + left];
+                glm::vec3 along_col = pos[down*col_count + col] 
+                                      - pos[up*col_count + col];
+                glm::vec3 n = glm::cross(along_row, along_col);
+                float length = glm::length(n);
+                /* Keep the last normal where the cloth folds flat */
+                if (length > 0.0f) {
+                    normal[row*col_count + col] = n / length;
+                }
+            }
+        }
+    });
+}
+
+/* Rebuilds what the constraint path iterates over while sleeping is on:
+ * spans of awake points along each row and the constraints with at
+ * least one awake point, also grouped by color */
+void Cloth::build_awake_lists() {
+    awake_spans.clear();
+    for (int row=0; row<row_count; row++) {
+        int tile_row = row / SLEEP_TILE;
+        int start = -1;
+        for (int tc=0; tc<=tile_cols; tc++) {
+            bool awake = tc < tile_cols 
+                         && !tile_asleep[tile_row*tile_cols + tc];
+            if (awake && start < 0) {
+                start = tc * SLEEP_TILE;
+            } else if (!awake && start >= 0) {
+                int end = std::min(tc * SLEEP_TILE, col_count);
+                awake_spans.push_back(row*col_count + start);
+                awake_spans.push_back(row*col_count + end);
+                start = -1;
+            }
+        }
+    }
+
+    auto awake = [&](int c) {
+        return !point_asleep[constraints[c].a] 
+               || !point_asleep[constraints[c].b];
+    };
+    awake_constraints.clear();
+    for (int c=0; c<constraints.size(); c++) {
+        if (awake(c)) awake_constraints.push_back(c);
+    }
+    awake_colored.clear();
+    awake_color_offsets.assign(1, 0);
+    if (constraint_graph_valid) {
+        for (int c=0; c+1<color_offsets.size(); c++) {
+            for (int i=color_offsets[c]; i<color_offsets[c+1]; i++) {
+                if (awake(colored_constraints[i])) {
+                    awake_colored.push_back(colored_constraints[i]);
+                }
+            }
+            awake_color_offsets.push_back(awake_colored.size());
+        }
+        /* Constraints skipped by Jacobi keep no stale correction */
+        std::fill(corrections.begin(), corrections.end(), glm::vec3(0));
+    }
+    awake_lists_valid = true;
+}
+
+/* Called at the end of a step. Every awake tile records how far its
+ * points moved; tiles that stay under sleep_threshold for sleep_steps
+ * steps fall asleep. A tile that moved clearly wakes its eight
+ * neighbors. */
+void Cloth::update_sleep_state() {
+    std::vector<glm::vec3> &pos = particles.pos;
+    std::vector<glm::vec3> &old_pos = particles.old_pos;
+    int tile_count = tile_rows * tile_cols;
+
+    for_each_range(0, tile_count, [&](int first, int last) {
+        for (int t=first; t<last; t++) {
+            float motion = 0.0f;
+            if (!tile_asleep[t]) {
+                int row_end = std::min((t / tile_cols + 1) * SLEEP_TILE, 
+                                       row_count);
+                int col_end = std::min((t % tile_cols + 1) * SLEEP_TILE, 
+                                       col_count);
+                for (int r=t/tile_cols*SLEEP_TILE; r<row_end; r++) {
+                    for (int c=t%tile_cols*SLEEP_TILE; c<col_end; c++) {
+                        glm::vec3 d = pos[r*col_count + c] 
+                                      - old_pos[r*col_count + c];
+                        motion = std::max(motion, glm::dot(d, d));
+                    }
+                }
+            }
+            tile_motion[t] = motion;
+        }
+    });
+
+    /* Freezing a tile nudges the points next to it a little, so only
+     * clearly larger motion wakes the neighbors; anything above the
+     * threshold just keeps the tile itself awake. */
+    float limit = sleep_threshold * sleep_threshold;
+    float wake_limit = WAKE_FACTOR * WAKE_FACTOR * limit;
+    bool changed = false;
+    for (int t=0; t<tile_count; t++) {
+        if (tile_motion[t] <= limit) {
+            tile_quiet_steps[t]++;
+            if (!tile_asleep[t] && tile_quiet_steps[t] >= sleep_steps) {
+                tile_asleep[t] = 1;
+                changed = true;
+            }
+            continue;
+        }
+        tile_quiet_steps[t] = 0;
+        if (tile_motion[t] <= wake_limit) {
+            continue;
+        }
+        int tr = t / tile_cols;
+        int tc = t % tile_cols;
+        for (int r=std::max(tr-1, 0); r<=std::min(tr+1, tile_rows-1); r++) {
+            for (int c=std::max(tc-1, 0); c<=std::min(tc+1, tile_cols-1); 
+                 c++) {
+                int n = r * tile_cols + c;
+                tile_quiet_steps[n] = 0;
+                if (tile_asleep[n]) {
+                    tile_asleep[n] = 0;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    if (changed) {
+        update_point_sleep();
+        awake_lists_valid = false;
+    }
+}
+
+/* Called before a step. Every sleeping tile with a point close to where
+ * a collider moves this step is woken up, along with its neighbors, so
+ * colliders never pass through sleeping cloth. */
+void Cloth::wake_near_colliders() {
+    if (!colliders.moving()) {
+        return;
+    }
+    std::vector<glm::vec3> &pos = particles.pos;
+    for (int i=0; i<vertex_count; i++) {
+        if (!point_asleep[i] || 
+            !colliders.near_moving(pos[i], 2.0f * grid_size)) {
+            continue;
+        }
+        int tr = i / col_count / SLEEP_TILE;
+        int tc = (i % col_count) / SLEEP_TILE;
+        for (int r=std::max(tr-1, 0); r<=std::min(tr+1, tile_rows-1); r++) {
+            for (int c=std::max(tc-1, 0); c<=std::min(tc+1, tile_cols-1); 
+                 c++) {
+                tile_quiet_steps[r * tile_cols + c] = 0;
+                tile_asleep[r * tile_cols + c] = 0;
             }
         }
+        awake_lists_valid = false;
     }
+    if (!awake_lists_valid) {
+        update_point_sleep();
+    }
+}
 
+/* Copies the tile state to point_asleep */
+void Cloth::update_point_sleep() {
     for (int i=0; i<vertex_count; i++) {
-        vertices[i*3] = points[i]->pos.x;
-        vertices[i*3+1] = points[i]->pos.y;
-        vertices[i*3+2] = points[i]->pos.z;
+        point_asleep[i] = tile_asleep[(i / col_count / SLEEP_TILE) 
+                                      * tile_cols 
+                                      + (i % col_count) / SLEEP_TILE];
     }
+}
 
-    time += 0.03f;
-    
-    return true;
+void Cloth::wake() {
+    std::fill(tile_quiet_steps.begin(), tile_quiet_steps.end(), 0);
+    std::fill(tile_asleep.begin(), tile_asleep.end(), 0);
+    std::fill(point_asleep.begin(), point_asleep.end(), 0);
+    awake_lists_valid = false;
+}
+
+void Cloth::set_sleeping(bool on) {
+    sleeping = on;
+    wake();
+}
+
+bool Cloth::get_sleeping() {
+    return sleeping;
+}
+
+void Cloth::set_sleep_threshold(float distance) {
+    sleep_threshold = std::max(0.0f, distance);
+}
+
+void Cloth::set_sleep_steps(int steps) {
+    sleep_steps = std::max(1, steps);
+}
+
+int Cloth::get_awake_tile_count() {
+    int count = 0;
+    for (unsigned char asleep : tile_asleep) {
+        count += !asleep;
+    }
+    return count;
+}
+
+/* Drops the constraints torn during this step in a single pass */
+void Cloth::remove_torn_constraints() {
+    int kept = 0;
+    for (int i=0; i<constraints.size(); i++) {
+        if (!constraints[i].torn) {
+            if (kept != i) constraints[kept] = constraints[i];
+            kept++;
+        }
+    }
+    if (kept != constraints.size()) {
+        constraints.resize(kept);
+        constraint_graph_valid = false;
+        awake_lists_valid = false;
+    }
 }
 
 void Cloth::get_constraints() {
+    constraints.reserve(vertex_count * 8);
     for (int i=0; i<vertex_count; i++) {
         int row = i / col_count;
         int col = i - row * col_count;
         if (col < col_count-1) {
-            Constraint* right = new Constraint();
-            right->rest_distance = grid_size;
-            right->a = i;
-            right->b = i+1;
-            constraints.push_back(right);
+            // right
+            constraints.push_back({i, i+1, grid_size, STRUCTURAL});
         }
         if (row < row_count-1) {
-            Constraint* down = new Constraint();
-            down->rest_distance = grid_size;
-            down->a = i;
-            down->b = i+col_count;
-            constraints.push_back(down);
+            // down
+            constraints.push_back({i, i+col_count, grid_size, STRUCTURAL});
         }
         if (col < col_count-1 && row < row_count-1) {
-            Constraint* down_right = new Constraint();
-            down_right->rest_distance = grid_size * SQRT_2;
-            down_right->a = i;
-            down_right->b = i+col_count+1;
-            constraints.push_back(down_right);
+            // down_right
+            constraints.push_back({i, i+col_count+1, grid_size * SQRT_2, 
+                                   SHEAR});
         }
         if (row > 0 && col < col_count-1) {
-            Constraint* up_right = new Constraint();
-            up_right->rest_distance = grid_size * SQRT_2;
-            up_right->a = i;
-            up_right->b = i-col_count+1;
-            constraints.push_back(up_right);
+            // up_right
+            constraints.push_back({i, i-col_count+1, grid_size * SQRT_2, 
+                                   SHEAR});
         }
         if (col < col_count-2) {
-            Constraint* right = new Constraint();
-            right->rest_distance = grid_size * 2;
-            right->a = i;
-            right->b = i+1;
-            constraints.push_back(right);
+            // right, two cells over
+            constraints.push_back({i, i+2, grid_size * 2, BEND});
         }
         if (row < row_count-2) {
-            Constraint* down = new Constraint();
-            down->rest_distance = grid_size * 2;
-            down->a = i;
-            down->b = i+col_count;
-            constraints.push_back(down);
+            // down, two cells over
+            constraints.push_back({i, i+col_count*2, grid_size * 2, BEND});
         }
         if (col < col_count-2 && row < row_count-2) {
-            Constraint* down_right = new Constraint();
-            down_right->rest_distance = grid_size * SQRT_2 * 2;
-            down_right->a = i;
-            down_right->b = i+col_count+1;
-            constraints.push_back(down_right);
+            // down_right, two cells over
+            constraints.push_back({i, i+col_count*2+2, 
+                                   grid_size * SQRT_2 * 2, BEND});
         }
         if (row > 1 && col < col_count-2) {
-            Constraint* up_right = new Constraint();
-            up_right->rest_distance = grid_size * SQRT_2 * 2;
-            up_right->a = i;
-            up_right->b = i-col_count+1;
-            constraints.push_back(up_right);
+            // up_right, two cells over
+            constraints.push_back({i, i-col_count*2+2, 
+                                   grid_size * SQRT_2 * 2, BEND});
         }
     }
 }
@@ -391,3 +1233,172 @@ glm::vec3 Cloth::get_ball_center() {
     return ball_center;
 }
 
+void Cloth::set_ball(glm::vec3 center, float radius) {
+    ball_center = center;
+    ball_radius = radius;
+    colliders.move_sphere(0, center, radius);
+}
+
+ColliderSet &Cloth::get_colliders() {
+    return colliders;
+}
+
+void Cloth::translate(glm::vec3 offset) {
+    for (int i=0; i<vertex_count; i++) {
+        particles.pos[i] += offset;
+        particles.old_pos[i] += offset;
+    }
+    wake();
+}
+
+Point Cloth::get_point(int i) {
+    return Point(particles, i);
+}
+
+
+void Cloth::write_snapshot(std::ostream &out) const {
+    out.write(SNAPSHOT_MAGIC, 8);
+    write_value(out, SNAPSHOT_VERSION);
+    write_value(out, row_count);
+    write_value(out, col_count);
+    write_value(out, mode);
+    write_value(out, pin_four);
+
+    /* Parameters */
+    write_value(out, mass);
+    write_value(out, k);
+    write_value(out, time);
+    write_value(out, generation);
+    write_value(out, wind);
+    write_value(out, ball_center);
+    write_value(out, ball_radius);
+    write_value(out, (int)constraint_solver);
+    write_value(out, compliance);
+    write_value(out, substeps);
+    write_value(out, frame_timestep);
+    write_value(out, self_collision);
+    write_value(out, thickness);
+    write_value(out, compute_normals);
+    write_value(out, sleeping);
+    write_value(out, sleep_threshold);
+    write_value(out, sleep_steps);
+
+    /* State */
+    write_vector(out, particles.pos);
+    write_vector(out, particles.old_pos);
+    write_vector(out, particles.normal);
+    write_vector(out, particles.pinned);
+    write_value(out, (uint64_t)constraints.size());
+    for (const Constraint &it : constraints) {
+        write_value(out, it.a);
+        write_value(out, it.b);
+        write_value(out, it.rest_distance);
+        write_value(out, it.type);
+    }
+    write_vector(out, tile_quiet_steps);
+    write_vector(out, tile_asleep);
+    colliders.write(out);
+}
+
+std::unique_ptr<Cloth> Cloth::read_snapshot(std::istream &in) {
+    char magic[8];
+    uint32_t version = 0;
+    in.read(magic, 8);
+    read_value(in, version);
+    if (!in || memcmp(magic, SNAPSHOT_MAGIC, 8) != 0 || 
+        version != SNAPSHOT_VERSION) {
+        return nullptr;
+    }
+    int r = 0, c = 0, m = 0;
+    bool p = false;
+    read_value(in, r);
+    read_value(in, c);
+    read_value(in, m);
+    read_value(in, p);
+    /* Positions, old positions, normals and pin flags of every point
+     * follow, so the stream must hold at least that much before the
+     * topology is built */
+    const int64_t point_bytes = 3 * sizeof(glm::vec3) + 1;
+    if (!in || r < 2 || c < 2 || (int64_t)r * c > (1 << 26) || 
+        (uint64_t)((int64_t)r * c * point_bytes) > bytes_left(in) ||
+        m < 0 || m > 3) {
+        return nullptr;
+    }
+    std::unique_ptr<Cloth> cloth(new Cloth(r, c, m, p));
+    Cloth &it = *cloth;
+
+    int solver = 0;
+    read_value(in, it.mass);
+    read_value(in, it.k);
+    read_value(in, it.time);
+    read_value(in, it.generation);
+    read_value(in, it.wind);
+    read_value(in, it.ball_center);
+    read_value(in, it.ball_radius);
+    read_value(in, solver);
+    read_value(in, it.compliance);
+    read_value(in, it.substeps);
+    read_value(in, it.frame_timestep);
+    read_value(in, it.self_collision);
+    read_value(in, it.thickness);
+    read_value(in, it.compute_normals);
+    read_value(in, it.sleeping);
+    read_value(in, it.sleep_threshold);
+    read_value(in, it.sleep_steps);
+    it.constraint_solver = (ConstraintSolver)solver;
+    auto positive = [](float v) { return std::isfinite(v) && v > 0.0f; };
+    bool compliance_valid = true;
+    for (float value : it.compliance) {
+        compliance_valid &= std::isfinite(value) && value >= 0.0f;
+    }
+    if (!in || it.substeps < 1 || !positive(it.frame_timestep) ||
+        it.sleep_steps < 1 || !positive(it.thickness) ||
+        !std::isfinite(it.sleep_threshold) || it.sleep_threshold < 0.0f ||
+        !compliance_valid) {
+        return nullptr;
+    }
+
+    uint64_t n = it.vertex_count;
+    read_vector(in, it.particles.pos, n);
+    read_vector(in, it.particles.old_pos, n);
+    read_vector(in, it.particles.normal, n);
+    read_vector(in, it.particles.pinned, n);
+    uint64_t constraint_count = 0;
+    read_value(in, constraint_count);
+    if (!in || constraint_count > it.constraints.size()) {
+        return nullptr;
+    }
+    it.constraints.resize(constraint_count);
+    for (Constraint &constraint : it.constraints) {
+        read_value(in, constraint.a);
+        read_value(in, constraint.b);
+        read_value(in, constraint.rest_distance);
+        read_value(in, constraint.type);
+        constraint.torn = false;
+        if (constraint.a < 0 || constraint.a >= n || 
+            constraint.b < 0 || constraint.b >= n ||
+            constraint.type < 0 || constraint.type >= CONSTRAINT_TYPE_COUNT ||
+            !positive(constraint.rest_distance)) {
+            return nullptr;
+        }
+    }
+    uint64_t tile_count = it.tile_rows * it.tile_cols;
+    read_vector(in, it.tile_quiet_steps, tile_count);
+    read_vector(in, it.tile_asleep, tile_count);
+    it.colliders.read(in);
+    if (!in || it.particles.pos.size() != n || 
+        it.particles.old_pos.size() != n || 
+        it.particles.normal.size() != n || 
+        it.particles.pinned.size() != n ||
+        it.tile_quiet_steps.size() != tile_count ||
+        it.tile_asleep.size() != tile_count ||
+        it.colliders.get_spheres().empty() ||
+        solver < 0 || solver > JACOBI) {
+        return nullptr;
+    }
+
+    it.constraint_graph_valid = false;
+    it.awake_lists_valid = false;
+    it.update_point_sleep();
+    return cloth;
+}
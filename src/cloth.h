@@ -7,34 +7,158 @@
 #ifndef CLOTH_H
 #define CLOTH_H
 
+#include <cstdint>
+#include <functional>
+#include <istream>
+#include <memory>
+#include <ostream>
 #include <vector>
+#include "absl/types/span.h"
+#include "collider.h"
+#include "particles.h"
+#include "implicit_solver.h"
 #include "point.h"
+#include "spatial_hash.h"
+#include "spring_kernel.h"
+#include "thread_pool.h"
+
+enum ConstraintType {
+    STRUCTURAL,  // Between direct grid neighbors
+    SHEAR,       // Across the diagonal of a grid cell
+    BEND,        // Between points two cells apart
+    CONSTRAINT_TYPE_COUNT
+};
 
 struct Constraint {
     int a;
     int b;
     float rest_distance;
+    int type;
+    bool torn = false;
 };
 
+/* Moves the ball along x (J/L), y (I/K) or z (U/O), or shrinks and grows
+ * it ([/]), for one key press. Shared by everything that drives a ball
+ * from the keyboard so the controls feel the same. */
+void apply_ball_control(char input, glm::vec3 &center, float &radius);
+
 class Cloth {
 public:
+    static const int SLEEP_TILE = 8;  // Points per side of a sleep tile
+    static constexpr float WAKE_FACTOR = 50.0f;  // Wake motion / threshold
+
+    /* How update_points_constraint projects the constraints. XPBD has
+     * no Jacobi variant and projects by color for JACOBI as well. */
+    enum ConstraintSolver {
+        GAUSS_SEIDEL,   // Serial, in construction order
+        GRAPH_COLORED,  // Colors of independent constraints, each in parallel
+        JACOBI          // All constraints at once, corrections averaged
+    };
+
     Cloth();
     Cloth(int, int, int, bool);
-    int mode;  // 0 for mass-spring, 1 for constraint based
-    std::vector<int> get_indices();
-    std::vector<GLfloat> get_vertices();
+    ~Cloth();
+    int mode;  // 0 for mass-spring, 1 for constraint based, 2 for XPBD,
+               // 3 for implicit mass-spring
+    const std::vector<int> &get_indices() const;
+    /* Point positions as interleaved x/y/z floats, written in place by
+     * the update functions, so they can be uploaded without a copy. The
+     * span stays valid for the lifetime of the cloth. */
+    absl::Span<const float> get_positions() const;
+    /* Incremented by every update, so readers can tell whether the
+     * positions changed since they last looked */
+    uint64_t get_generation() const;
+    /* Opt-in per-point normals, recomputed from the grid at the end of
+     * every update and laid out like get_positions() */
+    void set_compute_normals(bool on);
+    bool get_compute_normals();
+    absl::Span<const float> get_normals() const;
     float get_grid_size();
     int get_row_count();
     int get_col_count(); 
-    bool update_points(std::vector<float> &vertices);
-    bool update_points_constraint(std::vector<float> &vertices);
+    bool update_points();
+    bool update_points_constraint();
+    bool update_points_xpbd();
+    bool update_points_implicit();
+    /* Calls the update function of the current mode */
+    bool update();
     void wind_on();
+    void set_wind(bool on);
+    bool get_wind();
     void ball_control(char input);
     void add_k();
     void reduce_k();
     void get_constraints();
+    void build_springs();
     float get_ball_radius();
     glm::vec3 get_ball_center();
+    void set_ball(glm::vec3 center, float radius);
+    /* Everything the cloth collides with. Sphere 0 is the ball, moved by
+     * ball_control and set_ball. Colliders moved between updates are
+     * swept from where they were at the end of the last update, so fast
+     * moves push the cloth instead of passing through it. */
+    ColliderSet &get_colliders();
+    /* Moves every point, pinned ones included, by offset */
+    void translate(glm::vec3 offset);
+    Point get_point(int i);
+    /* Opt-in parallel mode: per-vertex passes are split into row bands
+     * across a pool of n threads. n <= 1 goes back to serial. */
+    void set_thread_count(int n);
+    int get_thread_count();
+    /* Runs the passes on a pool owned by someone else, e.g. a ClothWorld
+     * stepping many cloths at once. nullptr goes back to serial. */
+    void set_thread_pool(ThreadPool *p);
+    void set_constraint_solver(ConstraintSolver s);
+    ConstraintSolver get_constraint_solver();
+    int get_color_count();
+    /* Indices of the constraints of color c, which share no point */
+    absl::Span<const int> get_color(int c);
+    int get_constraint_count();
+    const Constraint &get_constraint(int i) const;
+    /* Kernel used for the spring forces of update_points. Defaults to
+     * the fastest one the CPU supports. */
+    void set_spring_kernel(SpringKernel kernel);
+    SpringKernel get_spring_kernel();
+    /* XPBD parameters. Compliance is the inverse stiffness (m/N) of one
+     * constraint type; every frame of frame_timestep seconds is split
+     * into the given number of substeps. */
+    void set_compliance(ConstraintType type, float compliance);
+    float get_compliance(ConstraintType type);
+    void set_substeps(int n);
+    int get_substeps();
+    void set_frame_timestep(float dt);
+    float get_frame_timestep();
+    /* Conjugate gradient iterations used by the last implicit step */
+    int get_cg_iterations();
+    /* Opt-in self-collision: after each step (each substep for XPBD)
+     * points are pushed apart to at least thickness from each other.
+     * Thickness is kept below grid_size so grid neighbors at rest do
+     * not collide. */
+    void set_self_collision(bool on);
+    bool get_self_collision();
+    void set_thickness(float t);
+    float get_thickness();
+    /* Opt-in sleeping for update_points_constraint. The grid is split
+     * into tiles of SLEEP_TILE x SLEEP_TILE points; a tile whose points
+     * all moved less than the threshold for the given number of steps
+     * falls asleep and is skipped by integration and projection until
+     * a neighboring tile or the ball moves. wake() wakes everything,
+     * e.g. after points were moved from outside. */
+    void set_sleeping(bool on);
+    bool get_sleeping();
+    void set_sleep_threshold(float distance);
+    void set_sleep_steps(int steps);
+    int get_awake_tile_count();
+    void wake();
+    /* Compact binary snapshot of everything that decides how the cloth
+     * moves on: particles, pins, the constraints left after tearing,
+     * parameters, colliders, sleep state and the clock driving the wind.
+     * Stepping a restored cloth gives bit-identical results. Thread
+     * settings, the spring kernel and mesh colliders are not included. */
+    void write_snapshot(std::ostream &out) const;
+    /* New cloth restored from write_snapshot() output, or nullptr if the
+     * input is not a valid snapshot */
+    static std::unique_ptr<Cloth> read_snapshot(std::istream &in);
 private:
     int row_count;  // Row count (for points)
     int col_count;  // Column count (for points)
@@ -43,13 +167,94 @@ private:
     float mass;
     float k;
     float time;
+    uint64_t generation;
+    bool compute_normals;
     glm::vec3 ball_center;
     float ball_radius;
+    ColliderSet colliders;
     bool wind;
     bool pin_four;
-    std::vector<Point*> points;  
+    Particles particles;
     std::vector<int> indices;
-    std::vector<Constraint*> constraints;
+    /* Spring topology in CSR form, used by the implicit integrator. The
+     * springs of point i are spring_neighbors/spring_rest[spring_offsets[i]
+     * ..spring_offsets[i+1]) */
+    std::vector<int> spring_offsets;
+    std::vector<int> spring_neighbors;
+    std::vector<float> spring_rest;
+    /* Scratch for the row spring kernel: positions split into x/y/z and
+     * the resulting spring forces */
+    SpringKernel spring_kernel;
+    std::vector<float> soa_x, soa_y, soa_z;
+    std::vector<float> spring_fx, spring_fy, spring_fz;
+    /* State of the implicit integrator, which takes a whole
+     * frame_timestep per step along the spring topology */
+    ImplicitSolver implicit_solver;
+    std::vector<glm::vec3> velocity;
+    std::vector<glm::vec3> external_force;
+    std::vector<glm::vec3> velocity_change;
+    int cg_iterations;
+    std::vector<Constraint> constraints;
+    ConstraintSolver constraint_solver;
+    float compliance[CONSTRAINT_TYPE_COUNT];
+    int substeps;
+    float frame_timestep;
+    /* Constraint graph used by the parallel solvers, rebuilt lazily after
+     * the constraint list changes. colored_constraints holds constraint
+     * indices grouped by color; no two constraints within
+     * [color_offsets[c], color_offsets[c+1]) share a point.
+     * point_constraints lists, per point, 2 * constraint index + side
+     * (0 for a, 1 for b) in CSR form for the Jacobi gather. */
+    bool constraint_graph_valid;
+    std::vector<int> colored_constraints;
+    std::vector<int> color_offsets;
+    std::vector<int> point_constraint_offsets;
+    std::vector<int> point_constraints;
+    std::vector<glm::vec3> corrections;
+    /* Self-collision state. The hash is rebuilt from the positions
+     * every time collide_self runs; collision_pos holds the corrected
+     * positions so every point reads the same old ones. */
+    bool self_collision;
+    float thickness;
+    SpatialHash spatial_hash;
+    std::vector<glm::vec3> collision_pos;
+    /* Sleeping state. point_asleep mirrors tile_asleep per point and is
+     * all zero while sleeping is off. The awake_* lists hold the row
+     * spans and constraints that still need work and are rebuilt when a
+     * tile changes state or constraints are dropped. */
+    bool sleeping;
+    float sleep_threshold;
+    int sleep_steps;
+    int tile_rows;
+    int tile_cols;
+    std::vector<int> tile_quiet_steps;
+    std::vector<unsigned char> tile_asleep;
+    std::vector<float> tile_motion;
+    std::vector<unsigned char> point_asleep;
+    bool awake_lists_valid;
+    std::vector<int> awake_spans;  // first/last point pairs
+    std::vector<int> awake_constraints;
+    std::vector<int> awake_colored;
+    std::vector<int> awake_color_offsets;
+    std::unique_ptr<ThreadPool> own_pool;
+    ThreadPool *pool;
+    /* Templates over the callable, so passes with many captures are not
+     * wrapped in a std::function (and allocated) on every call */
+    template <typename F> void for_each_band(const F &fn);
+    template <typename F> void for_each_range(int begin, int end,
+                                              const F &fn);
+    template <typename F> void for_each_awake(const F &fn);
+    void build_constraint_graph();
+    void project_colored();
+    void project_jacobi();
+    void project_xpbd(float dt);
+    void remove_torn_constraints();
+    void collide_self();
+    void update_normals();
+    void build_awake_lists();
+    void update_sleep_state();
+    void wake_near_colliders();
+    void update_point_sleep();
 };
 
 #endif
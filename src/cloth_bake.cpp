@@ -0,0 +1,117 @@
+// Bakes a cloth simulation into a cache file that noin can play back with
+// --play-cache, and prints one JSON object describing the bake:
+//
+//   cloth_bake --out=cloth.cache [--size=64] [--mode=1] [--frames=1000]
+//              [--threads=1] [--wind=on] [--quantize=off] [--normals=on]
+//
+// Frames are streamed to the file as they are simulated, so memory use
+// does not grow with --frames.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include "cloth.h"
+#include "cloth_cache.h"
+
+struct BakeOptions {
+  std::string out;
+  int size = 64;
+  int mode = 1;
+  int frames = 1000;
+  int threads = 1;
+  bool wind = true;
+  bool quantize = false;
+  bool normals = true;
+};
+
+static void print_usage() {
+  std::fprintf(stderr,
+               "Usage: cloth_bake --out=cloth.cache [--size=64] [--mode=1] "
+               "[--frames=1000]\n"
+               "                  [--threads=1] [--wind=on] [--quantize=off] "
+               "[--normals=on]\n"
+               "--size is at least 2 and --mode is 0 to 3\n");
+}
+
+static bool parse_options(int argc, char **argv, BakeOptions &options) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    size_t eq = arg.find('=');
+    std::string key = arg.substr(0, eq);
+    std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+    if (key == "--out") {
+      options.out = value;
+    } else if (key == "--size") {
+      options.size = std::atoi(value.c_str());
+    } else if (key == "--mode") {
+      options.mode = std::atoi(value.c_str());
+    } else if (key == "--frames") {
+      options.frames = std::atoi(value.c_str());
+    } else if (key == "--threads") {
+      options.threads = std::atoi(value.c_str());
+    } else if (key == "--wind") {
+      options.wind = value == "on";
+    } else if (key == "--quantize") {
+      options.quantize = value == "on";
+    } else if (key == "--normals") {
+      options.normals = value == "on";
+    } else {
+      std::fprintf(stderr, "Unknown option %s\n", arg.c_str());
+      return false;
+    }
+  }
+  if (options.out.empty()) {
+    std::fprintf(stderr, "Missing --out\n");
+    return false;
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  BakeOptions options;
+  if (!parse_options(argc, argv, options) || options.size < 2 ||
+      options.mode < 0 || options.mode > 3 || options.frames <= 0) {
+    print_usage();
+    return 1;
+  }
+
+  Cloth cloth(options.size, options.size, options.mode, true);
+  cloth.set_thread_count(options.threads);
+  cloth.set_wind(options.wind);
+  cloth.set_compute_normals(options.normals);
+
+  uint32_t flags = (options.quantize ? ClothCacheWriter::QUANTIZED : 0) |
+                   (options.normals ? ClothCacheWriter::NORMALS : 0);
+  ClothCacheWriter writer;
+  if (!writer.open(options.out, cloth.get_row_count(), cloth.get_col_count(),
+                   flags)) {
+    std::fprintf(stderr, "Could not create %s\n", options.out.c_str());
+    return 1;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < options.frames; i++) {
+    cloth.update();
+    if (!writer.append(cloth.get_positions(), cloth.get_normals())) {
+      std::fprintf(stderr, "Could not write frame %d\n", i);
+      return 1;
+    }
+  }
+  if (!writer.close()) {
+    std::fprintf(stderr, "Could not finish %s\n", options.out.c_str());
+    return 1;
+  }
+  auto end = std::chrono::steady_clock::now();
+  double seconds = std::chrono::duration<double>(end - start).count();
+
+  std::printf("{\"size\": %d, \"mode\": %d, \"frames\": %d, "
+              "\"quantize\": %s, \"normals\": %s, \"seconds\": %.6f, "
+              "\"frames_per_sec\": %.3f}\n",
+              options.size, options.mode, options.frames,
+              options.quantize ? "true" : "false",
+              options.normals ? "true" : "false", seconds,
+              options.frames / seconds);
+  return 0;
+}
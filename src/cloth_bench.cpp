@@ -0,0 +1,241 @@
+// Headless benchmark of the cloth simulation. Runs a fixed number of steps
+// for every combination of size, mode and scenario and prints one JSON
+// object per run:
+//
+//   cloth_bench [--sizes=32,64,128,256,512] [--modes=0,1,2,3] [--steps=100]
+//               [--threads=1] [--solver=gs|colored|jacobi] [--wind=both]
+//               [--tear=both] [--normals=off] [--sleep=off] [--settle=0]
+//
+// --wind and --tear take on, off or both; --normals turns on the per-point
+// normal pass. --sleep lets settled tiles sleep and --settle runs that many
+// untimed steps first, so an idle cloth can be measured. Tearing parks the
+// ball in front of the hanging cloth and inflates it every step, which rips
+// the constraint based modes and keeps the ball collision busy in the
+// others.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "cloth.h"
+
+// Global allocation counters, so the benchmark can tell how much the
+// simulation allocates per step.
+static std::atomic<long long> allocation_count(0);
+static std::atomic<long long> allocation_bytes(0);
+
+void *operator new(std::size_t size) {
+  allocation_count.fetch_add(1, std::memory_order_relaxed);
+  allocation_bytes.fetch_add(size, std::memory_order_relaxed);
+  void *p = std::malloc(size == 0 ? 1 : size);
+  if (p == nullptr) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+
+struct BenchOptions {
+  std::vector<int> sizes = {32, 64, 128, 256, 512};
+  std::vector<int> modes = {0, 1, 2, 3};
+  std::vector<bool> wind = {false, true};
+  std::vector<bool> tear = {false, true};
+  int steps = 100;
+  int threads = 1;
+  bool normals = false;
+  bool sleep = false;
+  int settle = 0;
+  Cloth::ConstraintSolver solver = Cloth::GAUSS_SEIDEL;
+};
+
+struct BenchResult {
+  double seconds;
+  long long allocations;
+  long long allocated_bytes;
+  int constraints_before;
+  int constraints_after;
+  int awake_tiles;
+};
+
+static std::vector<int> parse_list(const std::string &value) {
+  std::vector<int> result;
+  size_t start = 0;
+  while (start < value.size()) {
+    size_t end = value.find(',', start);
+    if (end == std::string::npos) {
+      end = value.size();
+    }
+    result.push_back(std::atoi(value.substr(start, end - start).c_str()));
+    start = end + 1;
+  }
+  return result;
+}
+
+static std::vector<bool> parse_switch(const std::string &value) {
+  if (value == "on") {
+    return {true};
+  }
+  if (value == "off") {
+    return {false};
+  }
+  return {false, true};
+}
+
+static void print_usage() {
+  std::fprintf(stderr,
+               "Usage: cloth_bench [--sizes=32,64,128,256,512] "
+               "[--modes=0,1,2,3] [--steps=100]\n"
+               "                   [--threads=1] [--solver=gs|colored|jacobi] "
+               "[--wind=both]\n"
+               "                   [--tear=both] [--normals=off] [--sleep=off] "
+               "[--settle=0]\n"
+               "Sizes are at least 2 and modes are 0 to 3\n");
+}
+
+// True when every size and mode names a cloth the simulation can build
+static bool valid_runs(const BenchOptions &options) {
+  for (int size : options.sizes) {
+    if (size < 2) {
+      return false;
+    }
+  }
+  for (int mode : options.modes) {
+    if (mode < 0 || mode > 3) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool parse_options(int argc, char **argv, BenchOptions &options) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    size_t eq = arg.find('=');
+    std::string key = arg.substr(0, eq);
+    std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+    if (key == "--sizes") {
+      options.sizes = parse_list(value);
+    } else if (key == "--modes") {
+      options.modes = parse_list(value);
+    } else if (key == "--steps") {
+      options.steps = std::atoi(value.c_str());
+    } else if (key == "--threads") {
+      options.threads = std::atoi(value.c_str());
+    } else if (key == "--wind") {
+      options.wind = parse_switch(value);
+    } else if (key == "--normals") {
+      options.normals = value == "on";
+    } else if (key == "--sleep") {
+      options.sleep = value == "on";
+    } else if (key == "--settle") {
+      options.settle = std::atoi(value.c_str());
+    } else if (key == "--tear") {
+      options.tear = parse_switch(value);
+    } else if (key == "--solver" && value == "gs") {
+      options.solver = Cloth::GAUSS_SEIDEL;
+    } else if (key == "--solver" && value == "colored") {
+      options.solver = Cloth::GRAPH_COLORED;
+    } else if (key == "--solver" && value == "jacobi") {
+      options.solver = Cloth::JACOBI;
+    } else {
+      std::fprintf(stderr, "Unknown option %s\n", arg.c_str());
+      return false;
+    }
+  }
+  return true;
+}
+
+static BenchResult run(const BenchOptions &options, int size, int mode,
+                       bool wind, bool tear) {
+  Cloth cloth(size, size, mode, true);
+  cloth.set_thread_count(options.threads);
+  cloth.set_constraint_solver(options.solver);
+  cloth.set_wind(wind);
+  cloth.set_compute_normals(options.normals);
+  cloth.set_sleeping(options.sleep);
+  if (tear) {
+    // The cloth is always one unit across, so the same ball moves put it
+    // just in front of the middle whatever the resolution.
+    for (int i = 0; i < 360; i++) cloth.ball_control('I');
+    for (int i = 0; i < 124; i++) cloth.ball_control('U');
+  }
+
+  // At least one untimed step so lazily built state (constraint graph,
+  // scratch buffers) is not counted against the steady state.
+  for (int i = 0; i < std::max(options.settle, 1); i++) {
+    cloth.update();
+  }
+
+  BenchResult result;
+  result.constraints_before = cloth.get_constraint_count();
+  long long count_before = allocation_count.load();
+  long long bytes_before = allocation_bytes.load();
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < options.steps; i++) {
+    if (tear) {
+      cloth.ball_control(']');
+      cloth.ball_control(']');
+    }
+    cloth.update();
+  }
+  auto end = std::chrono::steady_clock::now();
+  result.seconds = std::chrono::duration<double>(end - start).count();
+  result.allocations = allocation_count.load() - count_before;
+  result.allocated_bytes = allocation_bytes.load() - bytes_before;
+  result.constraints_after = cloth.get_constraint_count();
+  result.awake_tiles = cloth.get_awake_tile_count();
+  return result;
+}
+
+int main(int argc, char **argv) {
+  BenchOptions options;
+  if (!parse_options(argc, argv, options) || options.steps <= 0 ||
+      !valid_runs(options)) {
+    print_usage();
+    return 1;
+  }
+
+  const char *solver_names[] = {"gauss_seidel", "graph_colored", "jacobi"};
+  std::printf("[\n");
+  bool first = true;
+  for (int size : options.sizes) {
+    for (int mode : options.modes) {
+      for (bool wind : options.wind) {
+        for (bool tear : options.tear) {
+          BenchResult r = run(options, size, mode, wind, tear);
+          double particle_steps = (double)size * size * options.steps;
+          std::printf(
+              "%s  {\"size\": %d, \"particles\": %d, \"mode\": %d, "
+              "\"solver\": \"%s\", \"threads\": %d, \"wind\": %s, "
+              "\"tear\": %s, \"normals\": %s, \"sleep\": %s, "
+              "\"steps\": %d, "
+              "\"seconds\": %.6f, "
+              "\"ns_per_particle_step\": %.3f, \"steps_per_sec\": %.3f, "
+              "\"allocations\": %lld, \"allocated_bytes\": %lld, "
+              "\"allocations_per_step\": %.3f, \"constraints_before\": %d, "
+              "\"constraints_after\": %d, \"awake_tiles\": %d}",
+              first ? "" : ",\n", size, size * size, mode,
+              solver_names[options.solver], options.threads,
+              wind ? "true" : "false", tear ? "true" : "false",
+              options.normals ? "true" : "false",
+              options.sleep ? "true" : "false", options.steps, r.seconds,
+              r.seconds * 1e9 / particle_steps,
+              options.steps / r.seconds, r.allocations, r.allocated_bytes,
+              (double)r.allocations / options.steps, r.constraints_before,
+              r.constraints_after, r.awake_tiles);
+          std::fflush(stdout);
+          first = false;
+        }
+      }
+    }
+  }
+  std::printf("\n]\n");
+  return 0;
+}
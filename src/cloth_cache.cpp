@@ -0,0 +1,285 @@
+#include "cloth_cache.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char kCacheMagic[8] = {'C', 'L', 'O', 'T', 'H', 'C', 'C', 'H'};
+static const uint32_t kCacheVersion = 1;
+
+static_assert(sizeof(ClothCacheHeader) == 64, "header layout");
+
+static uint64_t round_up(uint64_t value, uint64_t multiple) {
+  return (value + multiple - 1) / multiple * multiple;
+}
+
+static uint64_t page_size() { return (uint64_t)sysconf(_SC_PAGESIZE); }
+
+// Bytes of one frame of n points. Quantized frames start with the
+// bounding box as min and step per axis.
+static uint32_t frame_size(uint32_t flags, uint64_t n) {
+  uint64_t bytes;
+  if (flags & ClothCacheWriter::QUANTIZED) {
+    bytes = 6 * sizeof(float) + 3 * n * sizeof(uint16_t);
+    if (flags & ClothCacheWriter::NORMALS) {
+      bytes += 3 * n * sizeof(int8_t);
+    }
+  } else {
+    bytes = 3 * n * sizeof(float);
+    if (flags & ClothCacheWriter::NORMALS) {
+      bytes += 3 * n * sizeof(float);
+    }
+  }
+  return (uint32_t)round_up(bytes, 8);
+}
+
+ClothCacheWriter::~ClothCacheWriter() { close(); }
+
+bool ClothCacheWriter::open(const std::string &path, int rows, int cols,
+                            uint32_t flags, int frames_per_chunk) {
+  close();
+  if (rows <= 0 || cols <= 0 || frames_per_chunk <= 0 ||
+      (uint64_t)rows * cols > (1u << 26)) {
+    return false;
+  }
+  fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return false;
+  }
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, kCacheMagic, sizeof(kCacheMagic));
+  header.version = kCacheVersion;
+  header.flags = flags & (QUANTIZED | NORMALS);
+  header.rows = rows;
+  header.cols = cols;
+  header.frames_per_chunk = frames_per_chunk;
+  header.frame_size = frame_size(header.flags, (uint64_t)rows * cols);
+  chunk_bytes = round_up((uint64_t)frames_per_chunk * header.frame_size,
+                         page_size());
+  offsets.clear();
+  chunk = nullptr;
+  chunk_offset = 0;
+  chunk_frames = 0;
+  return true;
+}
+
+bool ClothCacheWriter::map_next_chunk() {
+  uint64_t next = chunk == nullptr && offsets.empty()
+                      ? page_size()
+                      : chunk_offset + chunk_bytes;
+  unmap_chunk();
+  if (ftruncate(fd, next + chunk_bytes) != 0) {
+    return false;
+  }
+  void *p = mmap(nullptr, chunk_bytes, PROT_READ | PROT_WRITE, MAP_SHARED,
+                 fd, next);
+  if (p == MAP_FAILED) {
+    return false;
+  }
+  chunk = (uint8_t *)p;
+  chunk_offset = next;
+  chunk_frames = 0;
+  return true;
+}
+
+void ClothCacheWriter::unmap_chunk() {
+  if (chunk != nullptr) {
+    munmap(chunk, chunk_bytes);
+    chunk = nullptr;
+  }
+}
+
+bool ClothCacheWriter::append(absl::Span<const float> positions,
+                              absl::Span<const float> normals) {
+  uint64_t n = (uint64_t)header.rows * header.cols;
+  bool with_normals = header.flags & NORMALS;
+  if (fd < 0 || positions.size() != 3 * n ||
+      (with_normals && normals.size() != 3 * n)) {
+    return false;
+  }
+  if ((chunk == nullptr || chunk_frames == (int)header.frames_per_chunk) &&
+      !map_next_chunk()) {
+    return false;
+  }
+  uint8_t *frame = chunk + (uint64_t)chunk_frames * header.frame_size;
+
+  if (header.flags & QUANTIZED) {
+    float min[3] = {INFINITY, INFINITY, INFINITY};
+    float max[3] = {-INFINITY, -INFINITY, -INFINITY};
+    for (uint64_t i = 0; i < 3 * n; i++) {
+      min[i % 3] = std::min(min[i % 3], positions[i]);
+      max[i % 3] = std::max(max[i % 3], positions[i]);
+    }
+    float step[3];
+    for (int a = 0; a < 3; a++) {
+      step[a] = (max[a] - min[a]) / 65535.0f;
+    }
+    std::memcpy(frame, min, sizeof(min));
+    std::memcpy(frame + sizeof(min), step, sizeof(step));
+    uint16_t *q = (uint16_t *)(frame + sizeof(min) + sizeof(step));
+    for (uint64_t i = 0; i < 3 * n; i++) {
+      float s = step[i % 3];
+      long v = s > 0.0f ? std::lround((positions[i] - min[i % 3]) / s) : 0;
+      q[i] = (uint16_t)std::min(v, 65535L);
+    }
+    if (with_normals) {
+      int8_t *qn = (int8_t *)(q + 3 * n);
+      for (uint64_t i = 0; i < 3 * n; i++) {
+        qn[i] = (int8_t)std::lround(
+            std::max(-1.0f, std::min(1.0f, normals[i])) * 127.0f);
+      }
+    }
+  } else {
+    std::memcpy(frame, positions.data(), 3 * n * sizeof(float));
+    if (with_normals) {
+      std::memcpy(frame + 3 * n * sizeof(float), normals.data(),
+                  3 * n * sizeof(float));
+    }
+  }
+
+  offsets.push_back(chunk_offset +
+                    (uint64_t)chunk_frames * header.frame_size);
+  chunk_frames++;
+  return true;
+}
+
+bool ClothCacheWriter::close() {
+  if (fd < 0) {
+    return false;
+  }
+  unmap_chunk();
+  uint64_t end = offsets.empty() ? page_size()
+                                 : offsets.back() + header.frame_size;
+  header.frame_count = offsets.size();
+  header.index_offset = round_up(end, 8);
+  size_t index_bytes = offsets.size() * sizeof(uint64_t);
+  bool ok =
+      pwrite(fd, offsets.data(), index_bytes, header.index_offset) ==
+          (ssize_t)index_bytes &&
+      pwrite(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header) &&
+      ftruncate(fd, header.index_offset + index_bytes) == 0;
+  ok = ::close(fd) == 0 && ok;
+  fd = -1;
+  offsets.clear();
+  return ok;
+}
+
+ClothCacheReader::~ClothCacheReader() { close(); }
+
+bool ClothCacheReader::open(const std::string &path) {
+  close();
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  void *p = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(header)) {
+    p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  ::close(fd);
+  if (p == MAP_FAILED) {
+    return false;
+  }
+  data = (const uint8_t *)p;
+  size = st.st_size;
+  std::memcpy(&header, data, sizeof(header));
+
+  uint64_t n = (uint64_t)header.rows * header.cols;
+  bool valid =
+      std::memcmp(header.magic, kCacheMagic, sizeof(kCacheMagic)) == 0 &&
+      header.version == kCacheVersion && header.rows > 0 &&
+      header.cols > 0 && n <= (1u << 26) &&
+      header.frame_size == frame_size(header.flags, n) &&
+      header.index_offset % 8 == 0 && header.index_offset <= size &&
+      header.frame_count <= (size - header.index_offset) / sizeof(uint64_t);
+  if (valid) {
+    index = (const uint64_t *)(data + header.index_offset);
+    for (uint64_t i = 0; i < header.frame_count && valid; i++) {
+      valid = index[i] % 4 == 0 && index[i] <= size &&
+              header.frame_size <= size - index[i];
+    }
+  }
+  if (!valid) {
+    close();
+  }
+  return valid;
+}
+
+void ClothCacheReader::close() {
+  if (data != nullptr) {
+    munmap((void *)data, size);
+  }
+  data = nullptr;
+  size = 0;
+  index = nullptr;
+  std::memset(&header, 0, sizeof(header));
+}
+
+bool ClothCacheReader::is_quantized() const {
+  return header.flags & ClothCacheWriter::QUANTIZED;
+}
+
+bool ClothCacheReader::has_normals() const {
+  return header.flags & ClothCacheWriter::NORMALS;
+}
+
+bool ClothCacheReader::read_frame(uint64_t i, std::vector<float> &positions,
+                                  std::vector<float> *normals) const {
+  if (data == nullptr || i >= header.frame_count) {
+    return false;
+  }
+  uint64_t n = (uint64_t)header.rows * header.cols;
+  const uint8_t *frame = data + index[i];
+  positions.resize(3 * n);
+  if (normals != nullptr) {
+    normals->resize(has_normals() ? 3 * n : 0);
+  }
+
+  if (is_quantized()) {
+    float min[3];
+    float step[3];
+    std::memcpy(min, frame, sizeof(min));
+    std::memcpy(step, frame + sizeof(min), sizeof(step));
+    const uint16_t *q = (const uint16_t *)(frame + sizeof(min) + sizeof(step));
+    for (uint64_t j = 0; j < 3 * n; j++) {
+      positions[j] = min[j % 3] + q[j] * step[j % 3];
+    }
+    if (normals != nullptr && has_normals()) {
+      const int8_t *qn = (const int8_t *)(q + 3 * n);
+      for (uint64_t j = 0; j < 3 * n; j++) {
+        (*normals)[j] = qn[j] / 127.0f;
+      }
+    }
+  } else {
+    std::memcpy(positions.data(), frame, 3 * n * sizeof(float));
+    if (normals != nullptr && has_normals()) {
+      std::memcpy(normals->data(), frame + 3 * n * sizeof(float),
+                  3 * n * sizeof(float));
+    }
+  }
+  return true;
+}
+
+absl::Span<const float> ClothCacheReader::position_view(uint64_t i) const {
+  if (data == nullptr || i >= header.frame_count || is_quantized()) {
+    return {};
+  }
+  uint64_t n = (uint64_t)header.rows * header.cols;
+  return absl::Span<const float>((const float *)(data + index[i]), 3 * n);
+}
+
+absl::Span<const float> ClothCacheReader::normal_view(uint64_t i) const {
+  if (data == nullptr || i >= header.frame_count || is_quantized() ||
+      !has_normals()) {
+    return {};
+  }
+  uint64_t n = (uint64_t)header.rows * header.cols;
+  return absl::Span<const float>((const float *)(data + index[i]) + 3 * n,
+                                 3 * n);
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "absl/types/span.h"
+
+// Baked cloth animation on disk. A cache holds one frame of positions per
+// simulation step, optionally with normals, laid out like
+// Cloth::get_positions() and Cloth::get_normals(). Frames are stored in
+// page aligned chunks of frames_per_chunk frames, followed by an index of
+// frame offsets written when the cache is closed.
+//
+// Quantized caches store each frame as its bounding box plus 16 bits per
+// coordinate (an error of at most 1/131070 of the box) and normals as
+// 8 bits per component, about a third of the size of plain floats.
+
+// Fixed size header at the start of the file
+struct ClothCacheHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t flags;
+  int32_t rows;
+  int32_t cols;
+  uint32_t frames_per_chunk;
+  uint32_t frame_size;
+  uint64_t frame_count;
+  uint64_t index_offset;
+  uint8_t reserved[16];
+};
+
+class ClothCacheWriter {
+public:
+  static const uint32_t QUANTIZED = 1;
+  static const uint32_t NORMALS = 2;
+
+  ClothCacheWriter() = default;
+  ~ClothCacheWriter();
+  ClothCacheWriter(const ClothCacheWriter &) = delete;
+  ClothCacheWriter &operator=(const ClothCacheWriter &) = delete;
+
+  // Creates or replaces the file at path. flags is a combination of
+  // QUANTIZED and NORMALS.
+  bool open(const std::string &path, int rows, int cols, uint32_t flags,
+            int frames_per_chunk = 64);
+  // Appends one frame. Only the chunk being filled is mapped, so the
+  // frames written so far can leave memory as the kernel sees fit.
+  // normals is ignored unless the cache was opened with NORMALS.
+  bool append(absl::Span<const float> positions,
+              absl::Span<const float> normals = {});
+  // Writes the index and the header; the cache is incomplete until then
+  bool close();
+
+  bool is_open() const { return fd >= 0; }
+  uint64_t get_frame_count() const { return offsets.size(); }
+
+private:
+  int fd = -1;
+  ClothCacheHeader header;
+  std::vector<uint64_t> offsets;
+  size_t chunk_bytes = 0;
+  uint8_t *chunk = nullptr;
+  uint64_t chunk_offset = 0;
+  int chunk_frames = 0;
+
+  bool map_next_chunk();
+  void unmap_chunk();
+};
+
+class ClothCacheReader {
+public:
+  ClothCacheReader() = default;
+  ~ClothCacheReader();
+  ClothCacheReader(const ClothCacheReader &) = delete;
+  ClothCacheReader &operator=(const ClothCacheReader &) = delete;
+
+  // Maps the whole file read only; pages are loaded as frames are read
+  bool open(const std::string &path);
+  void close();
+
+  bool is_open() const { return data != nullptr; }
+  int get_rows() const { return header.rows; }
+  int get_cols() const { return header.cols; }
+  uint64_t get_frame_count() const { return header.frame_count; }
+  bool is_quantized() const;
+  bool has_normals() const;
+
+  // Decodes frame i into positions (and normals when the cache has them
+  // and normals is not null). False if i is out of range.
+  bool read_frame(uint64_t i, std::vector<float> &positions,
+                  std::vector<float> *normals = nullptr) const;
+  // Frames of unquantized caches point straight into the mapping, with
+  // no copy at all. Empty for quantized caches or caches without normals.
+  absl::Span<const float> position_view(uint64_t i) const;
+  absl::Span<const float> normal_view(uint64_t i) const;
+
+private:
+  const uint8_t *data = nullptr;
+  size_t size = 0;
+  ClothCacheHeader header;
+  const uint64_t *index = nullptr;
+};
@@ -0,0 +1,314 @@
+#include "cloth_recorder.h"
+
+#include <cstring>
+#include <sstream>
+
+#include "binary_io.h"
+
+static const char kLogMagic[8] = {'C', 'L', 'O', 'T', 'H', 'L', 'O', 'G'};
+static const uint32_t kLogVersion = 2;
+
+ClothRecorder::ClothRecorder(Cloth &cloth) : cloth(cloth) {
+  std::ostringstream out;
+  cloth.write_snapshot(out);
+  snapshot = out.str();
+  last_colliders = collider_bytes();
+  last_settings = settings();
+  complete = loggable_colliders();
+}
+
+bool ClothRecorder::loggable_colliders() const {
+  const ColliderSet &colliders = cloth.get_colliders();
+  return colliders.get_meshes().empty() && colliders.get_shared() == nullptr;
+}
+
+std::string ClothRecorder::collider_bytes() const {
+  std::ostringstream out;
+  cloth.get_colliders().write(out);
+  return out.str();
+}
+
+// Everything the cloth can be told to change by other means than the
+// recorder, that also changes how it moves
+std::vector<float> ClothRecorder::settings() const {
+  std::vector<float> values = {
+      (float)cloth.mode,
+      (float)cloth.get_substeps(),
+      cloth.get_frame_timestep(),
+      (float)cloth.get_constraint_solver(),
+      (float)cloth.get_sleeping(),
+      (float)cloth.get_self_collision(),
+      cloth.get_thickness(),
+      (float)cloth.get_wind(),
+      (float)cloth.get_spring_kernel(),
+  };
+  for (int t = 0; t < CONSTRAINT_TYPE_COUNT; t++) {
+    values.push_back(cloth.get_compliance((ConstraintType)t));
+  }
+  return values;
+}
+
+template <typename F>
+void ClothRecorder::record(ClothEvent::Type type, char key, glm::vec3 vector,
+                           float value, F fn) {
+  std::string colliders = collider_bytes();
+  if (colliders != last_colliders) {
+    ClothEvent event{};
+    event.type = ClothEvent::SET_COLLIDERS;
+    events.push_back(event);
+    collider_states.push_back(colliders);
+  }
+  if (settings() != last_settings || !loggable_colliders()) {
+    complete = false;
+  }
+
+  ClothEvent event{};
+  event.type = type;
+  event.key = key;
+  event.vector = vector;
+  event.value = value;
+  events.push_back(event);
+  fn();
+  // What the event itself changed is in the log already
+  last_colliders = collider_bytes();
+  last_settings = settings();
+}
+
+void ClothRecorder::ball_control(char input) {
+  record(ClothEvent::BALL_CONTROL, input, glm::vec3(0), 0.0f,
+         [&] { cloth.ball_control(input); });
+}
+
+void ClothRecorder::set_ball(glm::vec3 center, float radius) {
+  record(ClothEvent::SET_BALL, 0, center, radius,
+         [&] { cloth.set_ball(center, radius); });
+}
+
+void ClothRecorder::set_wind(bool on) {
+  record(ClothEvent::SET_WIND, on ? 1 : 0, glm::vec3(0), 0.0f,
+         [&] { cloth.set_wind(on); });
+}
+
+void ClothRecorder::translate(glm::vec3 offset) {
+  record(ClothEvent::TRANSLATE, 0, offset, 0.0f,
+         [&] { cloth.translate(offset); });
+}
+
+void ClothRecorder::add_k() {
+  record(ClothEvent::ADD_K, [&] { cloth.add_k(); });
+}
+
+void ClothRecorder::reduce_k() {
+  record(ClothEvent::REDUCE_K, [&] { cloth.reduce_k(); });
+}
+
+void ClothRecorder::set_substeps(int n) {
+  record(ClothEvent::SET_SUBSTEPS, 0, glm::vec3(0), (float)n,
+         [&] { cloth.set_substeps(n); });
+}
+
+void ClothRecorder::set_frame_timestep(float dt) {
+  record(ClothEvent::SET_FRAME_TIMESTEP, 0, glm::vec3(0), dt,
+         [&] { cloth.set_frame_timestep(dt); });
+}
+
+void ClothRecorder::set_compliance(ConstraintType type, float compliance) {
+  record(ClothEvent::SET_COMPLIANCE, (char)type, glm::vec3(0), compliance,
+         [&] { cloth.set_compliance(type, compliance); });
+}
+
+void ClothRecorder::set_constraint_solver(Cloth::ConstraintSolver solver) {
+  record(ClothEvent::SET_CONSTRAINT_SOLVER, (char)solver, glm::vec3(0), 0.0f,
+         [&] { cloth.set_constraint_solver(solver); });
+}
+
+void ClothRecorder::set_sleeping(bool on) {
+  record(ClothEvent::SET_SLEEPING, on ? 1 : 0, glm::vec3(0), 0.0f,
+         [&] { cloth.set_sleeping(on); });
+}
+
+void ClothRecorder::set_sleep_threshold(float distance) {
+  record(ClothEvent::SET_SLEEP_THRESHOLD, 0, glm::vec3(0), distance,
+         [&] { cloth.set_sleep_threshold(distance); });
+}
+
+void ClothRecorder::set_sleep_steps(int n) {
+  record(ClothEvent::SET_SLEEP_STEPS, 0, glm::vec3(0), (float)n,
+         [&] { cloth.set_sleep_steps(n); });
+}
+
+void ClothRecorder::wake() {
+  record(ClothEvent::WAKE, [&] { cloth.wake(); });
+}
+
+void ClothRecorder::set_self_collision(bool on) {
+  record(ClothEvent::SET_SELF_COLLISION, on ? 1 : 0, glm::vec3(0), 0.0f,
+         [&] { cloth.set_self_collision(on); });
+}
+
+void ClothRecorder::set_thickness(float thickness) {
+  record(ClothEvent::SET_THICKNESS, 0, glm::vec3(0), thickness,
+         [&] { cloth.set_thickness(thickness); });
+}
+
+bool ClothRecorder::update() {
+  bool result = false;
+  record(ClothEvent::UPDATE, [&] { result = cloth.update(); });
+  steps++;
+  return result;
+}
+
+void ClothRecorder::write(std::ostream &out) const {
+  out.write(kLogMagic, sizeof(kLogMagic));
+  write_value(out, kLogVersion);
+  write_value(out, (uint64_t)snapshot.size());
+  out.write(snapshot.data(), snapshot.size());
+  write_vector(out, events);
+  write_value(out, (uint64_t)collider_states.size());
+  for (const std::string &state : collider_states) {
+    write_value(out, (uint64_t)state.size());
+    out.write(state.data(), state.size());
+  }
+}
+
+bool ClothReplay::read(std::istream &in) {
+  char magic[sizeof(kLogMagic)];
+  uint32_t version = 0;
+  uint64_t snapshot_size = 0;
+  in.read(magic, sizeof(magic));
+  read_value(in, version);
+  read_value(in, snapshot_size);
+  if (!in || std::memcmp(magic, kLogMagic, sizeof(magic)) != 0 ||
+      version != kLogVersion || snapshot_size > bytes_left(in)) {
+    return false;
+  }
+  snapshot.resize(snapshot_size);
+  in.read(&snapshot[0], snapshot_size);
+  read_vector(in, events, bytes_left(in) / sizeof(ClothEvent));
+  uint64_t state_count = 0;
+  read_value(in, state_count);
+  if (!in || state_count > bytes_left(in) / sizeof(uint64_t)) {
+    return false;
+  }
+  collider_states.resize(state_count);
+  for (std::string &state : collider_states) {
+    uint64_t size = 0;
+    read_value(in, size);
+    if (!in || size > bytes_left(in)) {
+      return false;
+    }
+    state.resize(size);
+    in.read(&state[0], size);
+  }
+  if (!in) {
+    return false;
+  }
+
+  uint64_t collider_events = 0;
+  for (const ClothEvent &event : events) {
+    if (event.type > ClothEvent::LAST_TYPE ||
+        (event.type == ClothEvent::SET_COMPLIANCE &&
+         (event.key < 0 || event.key >= CONSTRAINT_TYPE_COUNT)) ||
+        (event.type == ClothEvent::SET_CONSTRAINT_SOLVER &&
+         (event.key < 0 || event.key > Cloth::JACOBI))) {
+      return false;
+    }
+    collider_events += event.type == ClothEvent::SET_COLLIDERS;
+  }
+  if (collider_events != collider_states.size()) {
+    return false;
+  }
+  for (const std::string &state : collider_states) {
+    ColliderSet colliders;
+    std::istringstream state_in(state);
+    colliders.read(state_in);
+    if (!state_in || colliders.get_spheres().empty()) {
+      return false;
+    }
+  }
+  return start() != nullptr;
+}
+
+std::unique_ptr<Cloth> ClothReplay::start() const {
+  std::istringstream in(snapshot);
+  return Cloth::read_snapshot(in);
+}
+
+int ClothReplay::run(Cloth &cloth,
+                     const std::function<void(int)> &on_step) const {
+  int steps = 0;
+  size_t collider_state = 0;
+  for (const ClothEvent &event : events) {
+    switch (event.type) {
+    case ClothEvent::UPDATE:
+      cloth.update();
+      steps++;
+      if (on_step) {
+        on_step(steps);
+      }
+      break;
+    case ClothEvent::BALL_CONTROL:
+      cloth.ball_control(event.key);
+      break;
+    case ClothEvent::SET_BALL:
+      cloth.set_ball(event.vector, event.value);
+      break;
+    case ClothEvent::SET_WIND:
+      cloth.set_wind(event.key != 0);
+      break;
+    case ClothEvent::TRANSLATE:
+      cloth.translate(event.vector);
+      break;
+    case ClothEvent::ADD_K:
+      cloth.add_k();
+      break;
+    case ClothEvent::REDUCE_K:
+      cloth.reduce_k();
+      break;
+    case ClothEvent::SET_COLLIDERS: {
+      std::istringstream in(collider_states[collider_state++]);
+      cloth.get_colliders().read(in);
+      break;
+    }
+    case ClothEvent::SET_SUBSTEPS:
+      cloth.set_substeps((int)event.value);
+      break;
+    case ClothEvent::SET_FRAME_TIMESTEP:
+      cloth.set_frame_timestep(event.value);
+      break;
+    case ClothEvent::SET_COMPLIANCE:
+      cloth.set_compliance((ConstraintType)event.key, event.value);
+      break;
+    case ClothEvent::SET_CONSTRAINT_SOLVER:
+      cloth.set_constraint_solver((Cloth::ConstraintSolver)event.key);
+      break;
+    case ClothEvent::SET_SLEEPING:
+      cloth.set_sleeping(event.key != 0);
+      break;
+    case ClothEvent::SET_SLEEP_THRESHOLD:
+      cloth.set_sleep_threshold(event.value);
+      break;
+    case ClothEvent::SET_SLEEP_STEPS:
+      cloth.set_sleep_steps((int)event.value);
+      break;
+    case ClothEvent::WAKE:
+      cloth.wake();
+      break;
+    case ClothEvent::SET_SELF_COLLISION:
+      cloth.set_self_collision(event.key != 0);
+      break;
+    case ClothEvent::SET_THICKNESS:
+      cloth.set_thickness(event.value);
+      break;
+    }
+  }
+  return steps;
+}
+
+int ClothReplay::get_step_count() const {
+  int steps = 0;
+  for (const ClothEvent &event : events) {
+    steps += event.type == ClothEvent::UPDATE;
+  }
+  return steps;
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "cloth.h"
+
+// One thing done to a cloth from outside. Updates are events too, so the
+// log keeps the order of inputs and steps exactly.
+struct ClothEvent {
+  enum Type : uint8_t {
+    UPDATE,
+    BALL_CONTROL,  // key
+    SET_BALL,      // vector = center, value = radius
+    SET_WIND,      // key = 0 or 1
+    TRANSLATE,     // vector = offset
+    ADD_K,
+    REDUCE_K,
+    SET_COLLIDERS,          // the next collider state stored in the log
+    SET_SUBSTEPS,           // value
+    SET_FRAME_TIMESTEP,     // value
+    SET_COMPLIANCE,         // key = ConstraintType, value
+    SET_CONSTRAINT_SOLVER,  // key = Cloth::ConstraintSolver
+    SET_SLEEPING,           // key = 0 or 1
+    SET_SLEEP_THRESHOLD,    // value
+    SET_SLEEP_STEPS,        // value
+    WAKE,
+    SET_SELF_COLLISION,     // key = 0 or 1
+    SET_THICKNESS,          // value
+    LAST_TYPE = SET_THICKNESS
+  };
+  Type type;
+  char key;
+  // Named so value initialization zeroes it and logs hold no stray bytes
+  uint8_t padding[2];
+  glm::vec3 vector;
+  float value;
+};
+
+// Records a session on a cloth so it can be replayed deterministically,
+// e.g. to check that a solver change leaves the output bit-identical.
+// The log starts with a snapshot of the cloth; drive the cloth through
+// the recorder from then on so every input lands in the log. Colliders
+// may be added and moved through the cloth's ColliderSet directly: the
+// recorder stores the whole set whenever it changed before an event.
+class ClothRecorder {
+public:
+  explicit ClothRecorder(Cloth &cloth);
+
+  void ball_control(char input);
+  void set_ball(glm::vec3 center, float radius);
+  void set_wind(bool on);
+  void translate(glm::vec3 offset);
+  void add_k();
+  void reduce_k();
+  void set_substeps(int n);
+  void set_frame_timestep(float dt);
+  void set_compliance(ConstraintType type, float compliance);
+  void set_constraint_solver(Cloth::ConstraintSolver solver);
+  void set_sleeping(bool on);
+  void set_sleep_threshold(float distance);
+  void set_sleep_steps(int steps);
+  void wake();
+  void set_self_collision(bool on);
+  void set_thickness(float thickness);
+  bool update();
+
+  // False once the cloth was changed in a way the log cannot hold: a
+  // setting changed on the cloth instead of through the recorder, or mesh
+  // or shared colliders, which belong to someone else. Replays of such a
+  // log may not match the session.
+  bool is_complete() const { return complete; }
+
+  int get_step_count() const { return steps; }
+  const std::vector<ClothEvent> &get_events() const { return events; }
+  void write(std::ostream &out) const;
+
+private:
+  Cloth &cloth;
+  std::string snapshot;
+  std::vector<ClothEvent> events;
+  std::vector<std::string> collider_states;
+  std::string last_colliders;
+  std::vector<float> last_settings;
+  bool complete = true;
+  int steps = 0;
+
+  std::string collider_bytes() const;
+  bool loggable_colliders() const;
+  std::vector<float> settings() const;
+  // Logs changes made around the recorder, then the event itself, and
+  // applies it through fn
+  template <typename F>
+  void record(ClothEvent::Type type, char key, glm::vec3 vector, float value,
+              F fn);
+  template <typename F> void record(ClothEvent::Type type, F fn) {
+    record(type, 0, glm::vec3(0), 0.0f, fn);
+  }
+};
+
+// A log written by ClothRecorder
+class ClothReplay {
+public:
+  // False if in does not hold a valid log
+  bool read(std::istream &in);
+
+  // New cloth in the state the recording started from
+  std::unique_ptr<Cloth> start() const;
+  // Applies the logged events to cloth, normally one from start(), and
+  // calls on_step with the step number after every update. Returns the
+  // number of steps taken.
+  int run(Cloth &cloth,
+          const std::function<void(int)> &on_step = nullptr) const;
+
+  int get_step_count() const;
+  const std::vector<ClothEvent> &get_events() const { return events; }
+
+private:
+  std::string snapshot;
+  std::vector<ClothEvent> events;
+  std::vector<std::string> collider_states;
+};
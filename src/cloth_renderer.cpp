@@ -0,0 +1,130 @@
+#include "cloth_renderer.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <GL/glew.h>
+
+#include "misc.h"
+
+ClothRenderer::ClothRenderer(int rows, int cols,
+                             const std::vector<int> &indices,
+                             std::vector<Texture> textures)
+    : point_count(rows * cols), index_count(indices.size()),
+      textures(textures) {
+  // Texture coordinates follow the grid and never change
+  std::vector<glm::vec2> uvs;
+  uvs.reserve(point_count);
+  for (int r = 0; r < rows; r++) {
+    for (int c = 0; c < cols; c++) {
+      uvs.push_back(glm::vec2(c / float(cols - 1), r / float(rows - 1)));
+    }
+  }
+
+  glGenVertexArrays(1, &vao);
+  glGenBuffers(1, &position_vbo);
+  glGenBuffers(1, &normal_vbo);
+  glGenBuffers(1, &texture_vbo);
+  glGenBuffers(1, &ebo);
+
+  glBindVertexArray(vao);
+  {
+    glBindBuffer(GL_ARRAY_BUFFER, position_vbo);
+    glBufferData(GL_ARRAY_BUFFER, point_count * sizeof(glm::vec3), nullptr,
+                 GL_DYNAMIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3),
+                          (void *)0);
+
+    glBindBuffer(GL_ARRAY_BUFFER, normal_vbo);
+    glBufferData(GL_ARRAY_BUFFER, point_count * sizeof(glm::vec3), nullptr,
+                 GL_DYNAMIC_DRAW);
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3),
+                          (void *)0);
+
+    glBindBuffer(GL_ARRAY_BUFFER, texture_vbo);
+    glBufferData(GL_ARRAY_BUFFER, uvs.size() * sizeof(glm::vec2), &uvs[0],
+                 GL_STATIC_DRAW);
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2),
+                          (void *)0);
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(int),
+                 &indices[0], GL_STATIC_DRAW);
+  }
+  glBindVertexArray(0);
+}
+
+ClothRenderer::~ClothRenderer() {
+  glDeleteVertexArrays(1, &vao);
+  glDeleteBuffers(1, &position_vbo);
+  glDeleteBuffers(1, &normal_vbo);
+  glDeleteBuffers(1, &texture_vbo);
+  glDeleteBuffers(1, &ebo);
+}
+
+void ClothRenderer::upload(absl::Span<const float> current,
+                           absl::Span<const float> previous, float alpha,
+                           absl::Span<const float> normals) {
+  if (current.empty()) {
+    return;
+  }
+  size_t count = std::min<size_t>(current.size(), point_count * 3);
+  glBindBuffer(GL_ARRAY_BUFFER, position_vbo);
+  float *dst = (float *)glMapBufferRange(
+      GL_ARRAY_BUFFER, 0, count * sizeof(float),
+      GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+  if (dst != nullptr) {
+    if (previous.size() == current.size() && alpha < 1.0f) {
+      for (size_t i = 0; i < count; i++) {
+        dst[i] = previous[i] + (current[i] - previous[i]) * alpha;
+      }
+    } else {
+      std::memcpy(dst, current.data(), count * sizeof(float));
+    }
+    glUnmapBuffer(GL_ARRAY_BUFFER);
+  }
+
+  if (!normals.empty()) {
+    glBindBuffer(GL_ARRAY_BUFFER, normal_vbo);
+    glBufferSubData(GL_ARRAY_BUFFER, 0,
+                    std::min(normals.size(), count) * sizeof(float),
+                    normals.data());
+  }
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void ClothRenderer::draw(Shader &shader, glm::mat4 model) {
+  unsigned int diffuse_count = 0;
+  unsigned int specular_count = 0;
+  for (unsigned int i = 0; i < textures.size(); i++) {
+    std::string name = textures[i].type;
+    if (name == "texture_diffuse") {
+      name = string_format("material.diffuse_%d", diffuse_count++);
+    } else if (name == "texture_specular") {
+      name = string_format("material.specular_%d", specular_count++);
+    } else {
+      continue;
+    }
+    glActiveTexture(GL_TEXTURE0 + i);
+    shader.setInt(name.c_str(), i);
+    glBindTexture(GL_TEXTURE_2D, textures[i].id);
+  }
+  shader.setFloat("material.shininess", 32.0f);
+  shader.setInt("material.numDiffuse", diffuse_count);
+  shader.setInt("material.numSpecular", specular_count);
+  shader.setInt("material.numEmission", 0);
+  glActiveTexture(GL_TEXTURE0);
+
+  shader.setMat4("model", model);
+  shader.setMat4("inv_model", glm::inverse(model));
+
+  // The cloth is a single sheet seen from both sides
+  glDisable(GL_CULL_FACE);
+  glBindVertexArray(vao);
+  glDrawElements(GL_TRIANGLES, index_count, GL_UNSIGNED_INT, 0);
+  glBindVertexArray(0);
+  glEnable(GL_CULL_FACE);
+}
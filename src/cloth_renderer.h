@@ -0,0 +1,39 @@
+#pragma once
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "absl/types/span.h"
+#include "mesh.h"
+#include "shader.h"
+
+// Draws a cloth grid straight from arrays laid out like
+// Cloth::get_positions() and Cloth::get_normals(). Positions and normals
+// have their own dynamic buffers and are written into mapped memory, so no
+// interleaved copy of the cloth is made on the way to the GPU.
+class ClothRenderer {
+public:
+  ClothRenderer(int rows, int cols, const std::vector<int> &indices,
+                std::vector<Texture> textures);
+  ~ClothRenderer();
+
+  ClothRenderer(const ClothRenderer &) = delete;
+  ClothRenderer &operator=(const ClothRenderer &) = delete;
+
+  // Uploads positions alpha of the way from previous to current. An empty
+  // previous uploads current as is.
+  void upload(absl::Span<const float> current, absl::Span<const float> previous,
+              float alpha, absl::Span<const float> normals);
+  void draw(Shader &shader, glm::mat4 model);
+
+private:
+  int point_count;
+  int index_count;
+  unsigned int vao;
+  unsigned int position_vbo;
+  unsigned int normal_vbo;
+  unsigned int texture_vbo;
+  unsigned int ebo;
+  std::vector<Texture> textures;
+};
@@ -0,0 +1,946 @@
+#include "gtest/gtest.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "bvh.h"
+#include "cloth.h"
+#include "cloth_cache.h"
+#include "cloth_recorder.h"
+#include "cloth_world.h"
+#include "spatial_hash.h"
+#include "triple_buffer.h"
+
+// Copy of the positions, so runs can be compared after the cloth is gone
+static std::vector<float> positions(const Cloth &cloth) {
+  absl::Span<const float> p = cloth.get_positions();
+  return std::vector<float>(p.begin(), p.end());
+}
+
+static std::vector<float> run_cloth(
+    int mode, int threads, int steps,
+    Cloth::ConstraintSolver solver = Cloth::GAUSS_SEIDEL) {
+  Cloth cloth(24, 24, mode, true);
+  cloth.set_thread_count(threads);
+  cloth.set_constraint_solver(solver);
+  cloth.wind_on();
+  for (int i = 0; i < steps; i++) {
+    if (i % 2 == 0) {
+      cloth.ball_control('O');
+    }
+    if (mode == 0) {
+      cloth.update_points();
+    } else if (mode == 1) {
+      cloth.update_points_constraint();
+    } else if (mode == 2) {
+      cloth.update_points_xpbd();
+    } else {
+      cloth.update_points_implicit();
+    }
+  }
+  return positions(cloth);
+}
+
+TEST(ClothTest, ParallelMassSpringMatchesSerial) {
+  std::vector<float> serial = run_cloth(0, 1, 200);
+  std::vector<float> parallel = run_cloth(0, 4, 200);
+  EXPECT_EQ(serial, parallel);
+}
+
+TEST(ClothTest, ParallelConstraintMatchesSerial) {
+  std::vector<float> serial = run_cloth(1, 1, 200);
+  std::vector<float> parallel = run_cloth(1, 4, 200);
+  EXPECT_EQ(serial, parallel);
+}
+
+TEST(ClothTest, ParallelGraphColoredMatchesSerial) {
+  std::vector<float> serial = run_cloth(1, 1, 200, Cloth::GRAPH_COLORED);
+  std::vector<float> parallel = run_cloth(1, 4, 200, Cloth::GRAPH_COLORED);
+  EXPECT_EQ(serial, parallel);
+}
+
+TEST(ClothTest, ParallelJacobiMatchesSerial) {
+  std::vector<float> serial = run_cloth(1, 1, 200, Cloth::JACOBI);
+  std::vector<float> parallel = run_cloth(1, 4, 200, Cloth::JACOBI);
+  EXPECT_EQ(serial, parallel);
+}
+
+TEST(ClothTest, ParallelXpbdMatchesSerial) {
+  std::vector<float> serial = run_cloth(2, 1, 50, Cloth::GRAPH_COLORED);
+  std::vector<float> parallel = run_cloth(2, 4, 50, Cloth::GRAPH_COLORED);
+  EXPECT_EQ(serial, parallel);
+}
+
+TEST(ClothTest, XpbdDoesNotDependOnFrameRate) {
+  // 30 fps with 20 substeps and 60 fps with 10 substeps take the same
+  // substeps, so the cloth should settle into the same shape. The wind
+  // follows simulated time too, only sampled once per frame.
+  for (bool wind : {false, true}) {
+    Cloth slow(16, 16, 2, false);
+    Cloth fast(16, 16, 2, false);
+    slow.set_wind(wind);
+    fast.set_wind(wind);
+    slow.set_frame_timestep(1.0f / 30.0f);
+    slow.set_substeps(20);
+    fast.set_frame_timestep(1.0f / 60.0f);
+    fast.set_substeps(10);
+    for (int i = 0; i < 90; i++) {
+      slow.update_points_xpbd();
+      fast.update_points_xpbd();
+      fast.update_points_xpbd();
+    }
+    absl::Span<const float> a = slow.get_positions();
+    absl::Span<const float> b = fast.get_positions();
+    for (int i = 0; i < a.size(); i++) {
+      ASSERT_FALSE(std::isnan(a[i]));
+      ASSERT_NEAR(a[i], b[i], wind ? 3e-3f : 1e-3f);
+    }
+  }
+}
+
+TEST(ClothTest, ParallelImplicitMatchesSerial) {
+  std::vector<float> serial = run_cloth(3, 1, 50);
+  std::vector<float> parallel = run_cloth(3, 4, 50);
+  EXPECT_EQ(serial, parallel);
+}
+
+TEST(ClothTest, ImplicitIsStableWithStiffSprings) {
+  Cloth cloth(32, 32, 3, true);
+  for (int i = 0; i < 30; i++) {
+    cloth.add_k();
+  }
+  for (int i = 0; i < 300; i++) {
+    cloth.update_points_implicit();
+    ASSERT_GT(cloth.get_cg_iterations(), 0);
+  }
+  EXPECT_EQ(cloth.get_generation(), 300);
+  for (float f : cloth.get_positions()) {
+    ASSERT_FALSE(std::isnan(f));
+    ASSERT_LT(std::abs(f), 10.0f);
+  }
+}
+
+TEST(ClothTest, SpringKernelsAgree) {
+  SpringKernel kernels[] = {SPRING_KERNEL_SSE, SPRING_KERNEL_AVX2};
+  for (SpringKernel kernel : kernels) {
+    if (!spring_kernel_supported(kernel)) {
+      continue;
+    }
+    Cloth scalar(37, 29, 0, true);
+    Cloth vector(37, 29, 0, true);
+    scalar.set_spring_kernel(SPRING_KERNEL_SCALAR);
+    vector.set_spring_kernel(kernel);
+    for (int i = 0; i < 100; i++) {
+      scalar.update_points();
+      vector.update_points();
+    }
+    absl::Span<const float> a = scalar.get_positions();
+    absl::Span<const float> b = vector.get_positions();
+    ASSERT_EQ(a.size(), b.size());
+    for (int i = 0; i < a.size(); i++) {
+      ASSERT_NEAR(a[i], b[i], 1e-5f) << spring_kernel_name(kernel);
+    }
+  }
+}
+
+TEST(ClothTest, GraphColoringIsSmall) {
+  Cloth cloth(24, 24, 1, true);
+  // Greedy coloring of the grid constraints stays close to the 16
+  // constraints a single point can belong to.
+  EXPECT_LE(cloth.get_color_count(), 31);
+  EXPECT_GE(cloth.get_color_count(), 16);
+
+  // Parallel projection relies on no two constraints of a color sharing a
+  // point, and on every constraint having exactly one color
+  std::vector<int> colors(cloth.get_constraint_count(), 0);
+  for (int c = 0; c < cloth.get_color_count(); c++) {
+    std::vector<bool> used(cloth.get_row_count() * cloth.get_col_count());
+    for (int i : cloth.get_color(c)) {
+      const Constraint &constraint = cloth.get_constraint(i);
+      ASSERT_FALSE(used[constraint.a]) << "color " << c;
+      ASSERT_FALSE(used[constraint.b]) << "color " << c;
+      used[constraint.a] = true;
+      used[constraint.b] = true;
+      colors[i]++;
+    }
+  }
+  for (int n : colors) {
+    ASSERT_EQ(n, 1);
+  }
+}
+
+TEST(ClothTest, GrowingBallTearsCloth) {
+  Cloth::ConstraintSolver solvers[] = {Cloth::GAUSS_SEIDEL,
+                                       Cloth::GRAPH_COLORED, Cloth::JACOBI};
+  for (Cloth::ConstraintSolver solver : solvers) {
+    Cloth cloth(16, 16, 1, true);
+    cloth.set_constraint_solver(solver);
+    absl::Span<const float> vertices = cloth.get_positions();
+    int constraint_count = cloth.get_constraint_count();
+
+    // Park the ball just in front of the middle of the hanging cloth and
+    // inflate it quickly so it rips through.
+    for (int i = 0; i < 360; i++) cloth.ball_control('I');
+    for (int i = 0; i < 124; i++) cloth.ball_control('U');
+    for (int i = 0; i < 100; i++) {
+      cloth.ball_control(']');
+      cloth.ball_control(']');
+      cloth.update_points_constraint();
+    }
+
+    EXPECT_LT(cloth.get_constraint_count(), constraint_count);
+    for (float f : vertices) {
+      ASSERT_FALSE(std::isnan(f));
+    }
+  }
+}
+
+TEST(ClothTest, FastBallDoesNotTunnel) {
+  for (int mode = 0; mode < 4; mode++) {
+    Cloth cloth(16, 16, mode, true);
+    cloth.set_ball(glm::vec3(0.5f, 0.5f, 0.3f), 0.1f);
+    cloth.update();
+    // In one step the ball jumps from in front of the cloth to behind it,
+    // further than its own diameter. It has to take the cloth along.
+    cloth.set_ball(glm::vec3(0.5f, 0.5f, -0.3f), 0.1f);
+    cloth.update();
+    float min_z = 0.0f;
+    absl::Span<const float> p = cloth.get_positions();
+    for (int i = 2; i < p.size(); i += 3) {
+      min_z = std::min(min_z, p[i]);
+    }
+    EXPECT_LT(min_z, -0.04f) << "mode " << mode;
+  }
+}
+
+TEST(ClothTest, DrapesOverCapsuleAndPlane) {
+  for (int mode = 1; mode < 3; mode++) {
+    // Gravity points along +y, so the plane is a floor at y = 0.2 and the
+    // capsule a rod across the cloth just above it.
+    Cloth cloth(16, 16, mode, false);
+    cloth.get_colliders().add_plane(glm::vec3(0, -1, 0),
+                                    glm::vec3(0, 0.2f, 0));
+    cloth.get_colliders().add_capsule(glm::vec3(-0.5f, 0.1f, 0.5f),
+                                      glm::vec3(1.5f, 0.1f, 0.5f), 0.05f);
+    for (int i = 0; i < 600; i++) {
+      cloth.update();
+    }
+    absl::Span<const float> p = cloth.get_positions();
+    float max_y = 0.0f;
+    for (int i = 0; i < p.size(); i += 3) {
+      max_y = std::max(max_y, p[i + 1]);
+      EXPECT_GT(glm::length(glm::vec3(0, p[i + 1] - 0.1f, p[i + 2] - 0.5f)),
+                0.04f);
+    }
+    EXPECT_LE(max_y, 0.2f + 1e-5f);
+    // It actually fell onto the floor
+    EXPECT_GT(max_y, 0.19f);
+  }
+}
+
+TEST(ClothTest, SettledClothFallsAsleep) {
+  Cloth::ConstraintSolver solvers[] = {Cloth::GAUSS_SEIDEL,
+                                       Cloth::GRAPH_COLORED};
+  for (Cloth::ConstraintSolver solver : solvers) {
+    Cloth cloth(24, 24, 1, true);
+    cloth.set_constraint_solver(solver);
+    cloth.set_sleeping(true);
+    for (int i = 0; i < 800; i++) {
+      cloth.update_points_constraint();
+    }
+    EXPECT_EQ(cloth.get_awake_tile_count(), 0);
+
+    // Asleep, the cloth does not move at all
+    std::vector<float> before = positions(cloth);
+    cloth.update_points_constraint();
+    EXPECT_EQ(positions(cloth), before);
+
+    // Moving the ball into the middle of the cloth wakes it up again
+    for (int i = 0; i < 360; i++) cloth.ball_control('I');
+    for (int i = 0; i < 124; i++) cloth.ball_control('U');
+    cloth.update_points_constraint();
+    EXPECT_GT(cloth.get_awake_tile_count(), 0);
+    for (int i = 0; i < 20; i++) {
+      cloth.ball_control('O');
+      cloth.update_points_constraint();
+    }
+    EXPECT_NE(positions(cloth), before);
+  }
+}
+
+TEST(ClothTest, SleepingClothStaysCloseToAwakeCloth) {
+  Cloth awake(24, 24, 1, true);
+  Cloth sleeping(24, 24, 1, true);
+  sleeping.set_sleeping(true);
+  for (int i = 0; i < 800; i++) {
+    awake.update_points_constraint();
+    sleeping.update_points_constraint();
+  }
+  std::vector<float> a = positions(awake);
+  std::vector<float> b = positions(sleeping);
+  for (int i = 0; i < a.size(); i++) {
+    EXPECT_NEAR(a[i], b[i], 0.01f);
+  }
+}
+
+TEST(ClothTest, ParallelSleepingMatchesSerial) {
+  Cloth::ConstraintSolver solvers[] = {Cloth::GAUSS_SEIDEL,
+                                       Cloth::GRAPH_COLORED, Cloth::JACOBI};
+  for (Cloth::ConstraintSolver solver : solvers) {
+    std::vector<float> result[2];
+    for (int run = 0; run < 2; run++) {
+      Cloth cloth(24, 24, 1, true);
+      cloth.set_thread_count(run == 0 ? 1 : 4);
+      cloth.set_constraint_solver(solver);
+      cloth.set_sleeping(true);
+      cloth.set_sleep_threshold(1e-3f);
+      for (int i = 0; i < 300; i++) {
+        if (i == 200) {
+          for (int j = 0; j < 360; j++) cloth.ball_control('I');
+        }
+        cloth.update_points_constraint();
+      }
+      result[run] = positions(cloth);
+    }
+    EXPECT_EQ(result[0], result[1]);
+  }
+}
+
+TEST(ClothTest, SwitchingSolverWhileSleepingKeepsConstraints) {
+  Cloth cloth(24, 24, 1, true);
+  cloth.set_sleeping(true);
+  // Awake lists built without a constraint graph
+  cloth.update_points_constraint();
+  cloth.set_constraint_solver(Cloth::GRAPH_COLORED);
+  for (int i = 0; i < 200; i++) {
+    cloth.update_points_constraint();
+  }
+  std::vector<float> p = positions(cloth);
+  int cols = cloth.get_col_count();
+  for (int i = 0; i + 1 < cloth.get_row_count() * cols; i++) {
+    if ((i + 1) % cols == 0) continue;
+    float dx = p[3 * i + 3] - p[3 * i];
+    float dy = p[3 * i + 4] - p[3 * i + 1];
+    float dz = p[3 * i + 5] - p[3 * i + 2];
+    ASSERT_LT(std::sqrt(dx * dx + dy * dy + dz * dz),
+              2.0f * cloth.get_grid_size());
+  }
+}
+
+// Drives a cloth through wind, ball moves and tearing
+template <typename C> static void busy_steps(C &cloth, int first, int count) {
+  for (int i = first; i < first + count; i++) {
+    if (i % 40 == 0) {
+      cloth.set_wind(i % 80 == 0);
+    }
+    cloth.ball_control(i < 60 ? 'I' : ']');
+    cloth.ball_control('U');
+    cloth.update();
+  }
+}
+
+TEST(ClothTest, SnapshotRestoresIdenticalCloth) {
+  for (int mode = 0; mode < 4; mode++) {
+    Cloth cloth(16, 16, mode, true);
+    cloth.set_self_collision(mode == 2);
+    cloth.set_sleeping(mode == 1);
+    cloth.set_constraint_solver(Cloth::GRAPH_COLORED);
+    busy_steps(cloth, 0, 100);
+
+    std::stringstream snapshot;
+    cloth.write_snapshot(snapshot);
+    std::unique_ptr<Cloth> copy = Cloth::read_snapshot(snapshot);
+    ASSERT_NE(copy, nullptr);
+    EXPECT_EQ(positions(*copy), positions(cloth));
+    EXPECT_EQ(copy->get_constraint_count(), cloth.get_constraint_count());
+    EXPECT_EQ(copy->get_generation(), cloth.get_generation());
+
+    busy_steps(cloth, 100, 100);
+    busy_steps(*copy, 100, 100);
+    EXPECT_EQ(positions(*copy), positions(cloth)) << "mode " << mode;
+  }
+}
+
+TEST(ClothTest, SnapshotRejectsBadInput) {
+  Cloth cloth(8, 8, 1, true);
+  std::stringstream snapshot;
+  cloth.write_snapshot(snapshot);
+  std::string bytes = snapshot.str();
+
+  std::stringstream truncated(bytes.substr(0, bytes.size() - 1));
+  EXPECT_EQ(Cloth::read_snapshot(truncated), nullptr);
+  std::stringstream garbage(std::string(bytes.size(), 'x'));
+  EXPECT_EQ(Cloth::read_snapshot(garbage), nullptr);
+  ClothReplay replay;
+  std::stringstream empty;
+  EXPECT_FALSE(replay.read(empty));
+
+  // Parameters the step divides by or indexes with are checked too. Odd
+  // values are easy to find in the bytes.
+  cloth.set_substeps(12345);
+  cloth.set_frame_timestep(0.0123f);
+  std::stringstream odd;
+  cloth.write_snapshot(odd);
+  auto corrupt = [&](auto value, auto replacement) {
+    std::string data = odd.str();
+    std::string from(reinterpret_cast<const char *>(&value), sizeof(value));
+    size_t offset = data.find(from);
+    EXPECT_NE(offset, std::string::npos);
+    std::memcpy(&data[offset], &replacement, sizeof(replacement));
+    std::stringstream in(data);
+    return Cloth::read_snapshot(in);
+  };
+  EXPECT_NE(corrupt(12345, 12345), nullptr);
+  EXPECT_EQ(corrupt(12345, 0), nullptr);
+  EXPECT_EQ(corrupt(0.0123f, -1.0f), nullptr);
+
+  // A grid far bigger than the stream is refused before it is built
+  std::string big = bytes;
+  int side = 4096;
+  std::memcpy(&big[12], &side, sizeof(side));
+  std::memcpy(&big[16], &side, sizeof(side));
+  std::stringstream big_in(big);
+  EXPECT_EQ(Cloth::read_snapshot(big_in), nullptr);
+}
+
+TEST(ClothTest, ReplayReproducesSession) {
+  Cloth cloth(16, 16, 1, true);
+  ClothRecorder recorder(cloth);
+  std::vector<std::vector<float>> recorded;
+  for (int i = 0; i < 150; i++) {
+    if (i == 70) {
+      recorder.translate(glm::vec3(0.01f, 0, 0));
+      recorder.set_ball(glm::vec3(0.5f, 0.5f, 0.2f), 0.2f);
+    }
+    busy_steps(recorder, i, 1);
+    recorded.push_back(positions(cloth));
+  }
+  std::stringstream log;
+  recorder.write(log);
+
+  ClothReplay replay;
+  ASSERT_TRUE(replay.read(log));
+  EXPECT_EQ(replay.get_step_count(), 150);
+  std::unique_ptr<Cloth> copy = replay.start();
+  int mismatches = 0;
+  int steps = replay.run(*copy, [&](int step) {
+    mismatches += positions(*copy) != recorded[step - 1];
+  });
+  EXPECT_EQ(steps, 150);
+  EXPECT_EQ(mismatches, 0);
+}
+
+TEST(ClothTest, ReplayCoversSettingsAndColliders) {
+  for (int mode = 1; mode <= 2; mode++) {
+    Cloth cloth(16, 16, mode, true);
+    ClothRecorder recorder(cloth);
+    std::vector<std::vector<float>> recorded;
+    int capsule = -1;
+    for (int i = 0; i < 120; i++) {
+      if (i == 10) {
+        recorder.set_substeps(6);
+        recorder.set_frame_timestep(1.0f / 45.0f);
+        recorder.set_compliance(BEND, 1e-4f);
+        recorder.set_constraint_solver(Cloth::GRAPH_COLORED);
+        recorder.set_sleeping(mode == 1);
+        recorder.set_sleep_threshold(1e-3f);
+        recorder.set_sleep_steps(5);
+      }
+      if (i == 30) {
+        // Straight on the cloth's colliders, not through the recorder
+        cloth.get_colliders().add_plane(glm::vec3(0, 0, 1),
+                                        glm::vec3(0, 0, -0.05f));
+        capsule = cloth.get_colliders().add_capsule(
+            glm::vec3(0.2f, 0.5f, 0.15f), glm::vec3(0.8f, 0.5f, 0.15f), 0.1f);
+        recorder.wake();
+      }
+      if (i > 30 && i < 60) {
+        // Through the hanging cloth, which lies in the z = 0 plane
+        float z = 0.15f - 0.01f * (i - 30);
+        cloth.get_colliders().move_capsule(capsule, glm::vec3(0.2f, 0.5f, z),
+                                           glm::vec3(0.8f, 0.5f, z));
+      }
+      if (i == 70) {
+        recorder.set_self_collision(true);
+        recorder.set_thickness(0.01f);
+      }
+      busy_steps(recorder, i, 1);
+      recorded.push_back(positions(cloth));
+    }
+    EXPECT_TRUE(recorder.is_complete());
+    std::stringstream log;
+    recorder.write(log);
+
+    ClothReplay replay;
+    ASSERT_TRUE(replay.read(log));
+    std::unique_ptr<Cloth> copy = replay.start();
+    int mismatches = 0;
+    replay.run(*copy, [&](int step) {
+      mismatches += positions(*copy) != recorded[step - 1];
+    });
+    EXPECT_EQ(mismatches, 0) << "mode " << mode;
+  }
+}
+
+TEST(ClothTest, RecorderFlagsChangesItCannotLog) {
+  Cloth cloth(8, 8, 2, true);
+  ClothRecorder recorder(cloth);
+  recorder.set_substeps(4);
+  recorder.update();
+  EXPECT_TRUE(recorder.is_complete());
+  cloth.set_substeps(8);
+  recorder.update();
+  EXPECT_FALSE(recorder.is_complete());
+}
+
+TEST(ClothTest, ReplayRejectsBadInput) {
+  Cloth cloth(8, 8, 1, true);
+  ClothRecorder recorder(cloth);
+  busy_steps(recorder, 0, 20);
+  std::stringstream log;
+  recorder.write(log);
+  std::string bytes = log.str();
+
+  ClothReplay replay;
+  std::stringstream truncated(bytes.substr(0, bytes.size() - 1));
+  EXPECT_FALSE(replay.read(truncated));
+
+  // Sizes far past the end of the log fail instead of being allocated
+  uint64_t huge = 1ull << 32;
+  uint64_t snapshot_size;
+  std::memcpy(&snapshot_size, &bytes[12], sizeof(snapshot_size));
+  for (size_t offset : {size_t(12), size_t(20 + snapshot_size)}) {
+    std::string corrupt = bytes;
+    std::memcpy(&corrupt[offset], &huge, sizeof(huge));
+    std::stringstream in(corrupt);
+    EXPECT_FALSE(replay.read(in));
+  }
+}
+
+static std::string temp_path(const std::string &name) {
+  return testing::TempDir() + "/" + name;
+}
+
+TEST(ClothCacheTest, PlainCacheRoundTripsExactly) {
+  Cloth cloth(12, 10, 1, true);
+  cloth.wind_on();
+  std::string path = temp_path("plain.clothcache");
+  ClothCacheWriter writer;
+  ASSERT_TRUE(writer.open(path, 12, 10, ClothCacheWriter::NORMALS, 8));
+  std::vector<std::vector<float>> recorded;
+  std::vector<std::vector<float>> normals;
+  for (int i = 0; i < 50; i++) {
+    busy_steps(cloth, i, 1);
+    absl::Span<const float> n = cloth.get_normals();
+    ASSERT_TRUE(writer.append(cloth.get_positions(), n));
+    recorded.push_back(positions(cloth));
+    normals.emplace_back(n.begin(), n.end());
+  }
+  ASSERT_TRUE(writer.close());
+
+  ClothCacheReader reader;
+  ASSERT_TRUE(reader.open(path));
+  ASSERT_EQ(reader.get_frame_count(), 50u);
+  EXPECT_EQ(reader.get_rows(), 12);
+  EXPECT_EQ(reader.get_cols(), 10);
+  std::vector<float> p;
+  std::vector<float> n;
+  for (int i = 0; i < 50; i++) {
+    ASSERT_TRUE(reader.read_frame(i, p, &n));
+    EXPECT_EQ(p, recorded[i]);
+    EXPECT_EQ(n, normals[i]);
+    absl::Span<const float> view = reader.position_view(i);
+    EXPECT_EQ(std::vector<float>(view.begin(), view.end()), recorded[i]);
+  }
+  EXPECT_FALSE(reader.read_frame(50, p));
+}
+
+TEST(ClothCacheTest, QuantizedCacheStaysWithinTheBox) {
+  Cloth cloth(16, 16, 2, true);
+  std::string path = temp_path("quantized.clothcache");
+  ClothCacheWriter writer;
+  ASSERT_TRUE(writer.open(path, 16, 16,
+                          ClothCacheWriter::QUANTIZED |
+                              ClothCacheWriter::NORMALS,
+                          4));
+  std::vector<std::vector<float>> recorded;
+  std::vector<std::vector<float>> normals;
+  for (int i = 0; i < 30; i++) {
+    busy_steps(cloth, i, 1);
+    absl::Span<const float> n = cloth.get_normals();
+    ASSERT_TRUE(writer.append(cloth.get_positions(), n));
+    recorded.push_back(positions(cloth));
+    normals.emplace_back(n.begin(), n.end());
+  }
+  ASSERT_TRUE(writer.close());
+
+  ClothCacheReader reader;
+  ASSERT_TRUE(reader.open(path));
+  ASSERT_EQ(reader.get_frame_count(), 30u);
+  EXPECT_TRUE(reader.is_quantized());
+  EXPECT_TRUE(reader.position_view(0).empty());
+  std::vector<float> p;
+  std::vector<float> n;
+  float worst = 0.0f;
+  float worst_normal = 0.0f;
+  for (int i = 0; i < 30; i++) {
+    ASSERT_TRUE(reader.read_frame(i, p, &n));
+    for (size_t j = 0; j < p.size(); j++) {
+      worst = std::max(worst, std::abs(p[j] - recorded[i][j]));
+      worst_normal = std::max(worst_normal, std::abs(n[j] - normals[i][j]));
+    }
+  }
+  // The cloth spans about a unit, so half a step is below 1e-5
+  EXPECT_LT(worst, 2e-5f);
+  EXPECT_LT(worst_normal, 0.5f / 127.0f + 1e-6f);
+}
+
+TEST(ClothCacheTest, ReaderRejectsUnfinishedCache) {
+  std::string path = temp_path("unfinished.clothcache");
+  std::vector<float> frame(3 * 4 * 4, 1.0f);
+  {
+    ClothCacheWriter writer;
+    ASSERT_TRUE(writer.open(path, 4, 4, 0));
+    ASSERT_TRUE(writer.append(frame));
+    EXPECT_FALSE(writer.append(std::vector<float>(5)));
+    ClothCacheReader reader;
+    EXPECT_FALSE(reader.open(path));
+    ASSERT_TRUE(writer.close());
+  }
+  ClothCacheReader reader;
+  ASSERT_TRUE(reader.open(path));
+  EXPECT_EQ(reader.get_frame_count(), 1u);
+  EXPECT_FALSE(reader.open(temp_path("missing.clothcache")));
+}
+
+TEST(ClothTest, NormalsFollowTheGrid) {
+  Cloth flat(8, 8, 1, false);
+  Cloth hanging(8, 8, 1, true);
+  flat.set_compute_normals(true);
+  hanging.set_compute_normals(true);
+  absl::Span<const float> a = flat.get_normals();
+  absl::Span<const float> b = hanging.get_normals();
+  ASSERT_EQ(a.size(), flat.get_positions().size());
+  for (int i = 0; i < a.size(); i += 3) {
+    EXPECT_EQ(glm::vec3(a[i], a[i + 1], a[i + 2]), glm::vec3(0, -1, 0));
+    EXPECT_EQ(glm::vec3(b[i], b[i + 1], b[i + 2]), glm::vec3(0, 0, 1));
+  }
+}
+
+TEST(ClothTest, ParallelNormalsMatchSerial) {
+  Cloth serial(24, 24, 0, true);
+  Cloth parallel(24, 24, 0, true);
+  parallel.set_thread_count(4);
+  serial.set_compute_normals(true);
+  parallel.set_compute_normals(true);
+  serial.set_wind(true);
+  parallel.set_wind(true);
+  for (int i = 0; i < 100; i++) {
+    serial.update_points();
+    parallel.update_points();
+  }
+  absl::Span<const float> a = serial.get_normals();
+  absl::Span<const float> b = parallel.get_normals();
+  ASSERT_EQ(std::vector<float>(a.begin(), a.end()),
+            std::vector<float>(b.begin(), b.end()));
+  for (int i = 0; i < a.size(); i += 3) {
+    EXPECT_NEAR(glm::length(glm::vec3(a[i], a[i + 1], a[i + 2])), 1.0f,
+                1e-5f);
+  }
+}
+
+// Smallest distance between two points that are not grid neighbors
+static float min_self_distance(Cloth &cloth) {
+  int cols = cloth.get_col_count();
+  int count = cloth.get_row_count() * cols;
+  float result = INFINITY;
+  for (int i = 0; i < count; i++) {
+    for (int j = i + 1; j < count; j++) {
+      if (std::abs(i / cols - j / cols) <= 1 &&
+          std::abs(i % cols - j % cols) <= 1) {
+        continue;
+      }
+      result = std::min(result, glm::length(cloth.get_point(i).pos -
+                                            cloth.get_point(j).pos));
+    }
+  }
+  return result;
+}
+
+static std::vector<float> drop_cloth(Cloth &cloth, int steps) {
+  // Release the flat cloth so it falls over the ball and folds onto itself
+  for (int i = 0; i < cloth.get_row_count() * cloth.get_col_count(); i++) {
+    cloth.get_point(i).set_pined(false);
+  }
+  for (int i = 0; i < steps; i++) {
+    cloth.update_points_xpbd();
+  }
+  return positions(cloth);
+}
+
+TEST(ClothTest, SelfCollisionKeepsThickness) {
+  Cloth loose(24, 24, 2, false);
+  drop_cloth(loose, 120);
+  EXPECT_LT(min_self_distance(loose), 0.5f * loose.get_thickness());
+
+  Cloth cloth(24, 24, 2, false);
+  cloth.set_self_collision(true);
+  drop_cloth(cloth, 120);
+  EXPECT_GE(min_self_distance(cloth), 0.9f * cloth.get_thickness());
+}
+
+TEST(ClothTest, ParallelSelfCollisionMatchesSerial) {
+  Cloth serial(24, 24, 2, false);
+  serial.set_self_collision(true);
+  Cloth parallel(24, 24, 2, false);
+  parallel.set_self_collision(true);
+  parallel.set_thread_count(4);
+  EXPECT_EQ(drop_cloth(serial, 60), drop_cloth(parallel, 60));
+}
+
+TEST(SpatialHashTest, QueryFindsAllNeighbors) {
+  std::vector<glm::vec3> points;
+  srand(7);
+  for (int i = 0; i < 2000; i++) {
+    points.push_back(glm::vec3(rand() % 1000, rand() % 1000, rand() % 1000) *
+                     0.001f);
+  }
+  float radius = 0.05f;
+  ThreadPool pool(4);
+  SpatialHash hash(radius);
+  hash.build(points.data(), points.size(), &pool);
+  for (int i = 0; i < points.size(); i++) {
+    std::vector<int> found;
+    hash.query(points[i], [&](int j) {
+      if (glm::length(points[i] - points[j]) < radius) found.push_back(j);
+    });
+    std::vector<int> expected;
+    for (int j = 0; j < points.size(); j++) {
+      if (glm::length(points[i] - points[j]) < radius) expected.push_back(j);
+    }
+    std::sort(found.begin(), found.end());
+    ASSERT_EQ(found, expected);
+  }
+}
+
+// Unit cube around the origin, counter-clockwise faces pointing out
+static void make_box(std::vector<glm::vec3> &vertices,
+                     std::vector<unsigned int> &indices) {
+  for (int i = 0; i < 8; i++) {
+    vertices.push_back(glm::vec3(i & 1 ? 0.5f : -0.5f, i & 2 ? 0.5f : -0.5f,
+                                 i & 4 ? 0.5f : -0.5f));
+  }
+  indices = {0, 3, 1, 0, 2, 3, 4, 7, 6, 4, 5, 7, 0, 5, 4, 0, 1, 5,
+             2, 7, 3, 2, 6, 7, 0, 6, 2, 0, 4, 6, 1, 7, 5, 1, 3, 7};
+}
+
+TEST(SpatialHashTest, ParallelBuildMatchesSerial) {
+  std::vector<glm::vec3> points;
+  srand(11);
+  for (int i = 0; i < 50000; i++) {
+    points.push_back(glm::vec3(rand() % 1000, rand() % 1000, rand() % 1000) *
+                     0.001f);
+  }
+  ThreadPool pool(4);
+  SpatialHash serial(0.02f);
+  SpatialHash parallel(0.02f);
+  serial.build(points.data(), points.size(), nullptr);
+  parallel.build(points.data(), points.size(), &pool);
+  for (int i = 0; i < points.size(); i += 97) {
+    std::vector<int> a, b;
+    serial.query(points[i], [&](int j) { a.push_back(j); });
+    parallel.query(points[i], [&](int j) { b.push_back(j); });
+    ASSERT_FALSE(a.empty());
+    ASSERT_EQ(a, b);
+  }
+}
+
+TEST(TriangleBVHTest, QueryFindsAllOverlaps) {
+  std::vector<glm::vec3> vertices;
+  std::vector<unsigned int> indices;
+  srand(11);
+  for (int i = 0; i < 3000; i++) {
+    vertices.push_back(glm::vec3(rand() % 1000, rand() % 1000, rand() % 1000) *
+                       0.001f);
+    indices.push_back(i / 3 * 3 + rand() % 3);
+  }
+  TriangleBVH bvh;
+  bvh.build(vertices, indices);
+  bvh.refit(glm::translate(glm::mat4(1.0f), glm::vec3(1, 2, 3)));
+  EXPECT_GE(bvh.bounds().min.y, 2.0f);
+  EXPECT_LE(bvh.bounds().max.y, 3.0f);
+  for (int i = 0; i < 200; i++) {
+    AABB box;
+    box.grow(glm::vec3(1, 2, 3) + vertices[i]);
+    box.grow(glm::vec3(1.1f, 2.1f, 3.1f) + vertices[i]);
+    std::vector<int> found;
+    bvh.query(box, [&](int t) { found.push_back(t); });
+    std::vector<int> expected;
+    for (int t = 0; t < bvh.triangle_count(); t++) {
+      AABB triangle;
+      for (int k = 0; k < 3; k++) triangle.grow(bvh.corner(t, k));
+      if (triangle.overlaps(box)) expected.push_back(t);
+    }
+    std::sort(found.begin(), found.end());
+    ASSERT_TRUE(std::includes(found.begin(), found.end(), expected.begin(),
+                              expected.end()));
+  }
+}
+
+TEST(ClothTest, DrapesOverMesh) {
+  std::vector<glm::vec3> vertices;
+  std::vector<unsigned int> indices;
+  make_box(vertices, indices);
+  for (int mode = 0; mode < 4; mode++) {
+    // Gravity points along +y, so the cloth falls onto the top of a box
+    // spanning 0.3 to 0.7 on every axis. Every other run places it with a
+    // mirroring transform, like the cloth's own model matrix.
+    TriangleBVH box;
+    box.build(vertices, indices);
+    box.refit(glm::scale(
+        glm::translate(glm::mat4(1.0f), glm::vec3(0.5f, 0.5f, 0.5f)),
+        glm::vec3(0.4f, mode % 2 ? -0.4f : 0.4f, 0.4f)));
+    Cloth cloth(24, 24, mode, false);
+    cloth.get_colliders().add_mesh(&box, 0.01f);
+    for (int i = 0; i < 600; i++) {
+      cloth.update();
+    }
+    absl::Span<const float> p = cloth.get_positions();
+    float min_y_on_top = 1.0f;
+    for (int i = 0; i < p.size(); i += 3) {
+      glm::vec3 point(p[i], p[i + 1], p[i + 2]);
+      bool above = point.x > 0.3f && point.x < 0.7f && point.z > 0.3f &&
+                   point.z < 0.7f;
+      EXPECT_FALSE(above && point.y > 0.3f && point.y < 0.7f)
+          << "mode " << mode;
+      if (above) {
+        min_y_on_top = std::min(min_y_on_top, point.y);
+      }
+    }
+    EXPECT_GT(min_y_on_top, 0.2f) << "mode " << mode;
+  }
+}
+
+static std::unique_ptr<Cloth> make_banner(int i) {
+  int size = i == 0 ? 40 : 12 + 2 * i;
+  std::unique_ptr<Cloth> cloth(new Cloth(size, size, i % 4, true));
+  cloth->translate(glm::vec3(1.2f * i, 0, 0));
+  return cloth;
+}
+
+TEST(ClothWorldTest, MatchesSteppingEachCloth) {
+  ClothWorld world(4);
+  world.set_split_threshold(40 * 40);
+  world.set_wind(true);
+  // Shared by every cloth of the world, and added to each lone cloth
+  glm::vec3 a(-2.0f, 0.5f, 0.3f);
+  glm::vec3 b(8.0f, 0.5f, 0.3f);
+  int capsule = world.get_colliders().add_capsule(a, b, 0.1f);
+  world.get_colliders().add_plane(glm::vec3(0, 0, 1), glm::vec3(0, 0, -0.2f));
+  std::vector<std::unique_ptr<Cloth>> alone;
+  for (int i = 0; i < 8; i++) {
+    world.add_cloth(make_banner(i));
+    alone.push_back(make_banner(i));
+    alone.back()->get_colliders().add_capsule(a, b, 0.1f);
+    alone.back()->get_colliders().add_plane(glm::vec3(0, 0, 1),
+                                            glm::vec3(0, 0, -0.2f));
+  }
+  for (int step = 0; step < 40; step++) {
+    world.ball_control('O');
+    world.ball_control('L');
+    // Sweeps the capsule back through the cloths
+    glm::vec3 offset(0, 0, -0.015f * step);
+    world.get_colliders().move_capsule(capsule, a + offset, b + offset);
+    world.step();
+    for (std::unique_ptr<Cloth> &cloth : alone) {
+      cloth->set_ball(world.get_ball_center(), world.get_ball_radius());
+      cloth->set_wind(true);
+      cloth->get_colliders().move_capsule(0, a + offset, b + offset);
+      cloth->update();
+    }
+  }
+  ASSERT_EQ(world.get_cloth(0)->get_thread_count(), 4);
+  ASSERT_EQ(world.get_cloth(1)->get_thread_count(), 1);
+  for (int i = 0; i < 8; i++) {
+    EXPECT_EQ(positions(*world.get_cloth(i)), positions(*alone[i]));
+    EXPECT_EQ(world.get_cloth(i)->get_generation(), 40);
+  }
+}
+
+TEST(ThreadPoolTest, NestedParallelFor) {
+  ThreadPool pool(4);
+  std::vector<int> hits(64 * 64, 0);
+  pool.parallel_for(0, 64, [&](int r0, int r1) {
+    for (int r = r0; r < r1; r++) {
+      pool.parallel_for(0, 64, [&](int c0, int c1) {
+        for (int c = c0; c < c1; c++) {
+          hits[r * 64 + c]++;
+        }
+      });
+    }
+  });
+  for (int h : hits) {
+    ASSERT_EQ(h, 1);
+  }
+}
+
+TEST(ThreadPoolTest, SubmitRunsInTheBackground) {
+  ThreadPool pool(3);
+  std::vector<std::future<int>> results;
+  for (int i = 0; i < 32; i++) {
+    results.push_back(pool.submit([i] { return i * i; }));
+  }
+  // Bands still run while the tasks are queued
+  std::atomic<int> sum(0);
+  pool.parallel_for(0, 100, [&](int begin, int end) {
+    for (int i = begin; i < end; i++) {
+      sum += i;
+    }
+  });
+  EXPECT_EQ(sum.load(), 4950);
+  for (int i = 0; i < 32; i++) {
+    EXPECT_EQ(results[i].get(), i * i);
+  }
+
+  ThreadPool inline_pool(1);
+  EXPECT_EQ(inline_pool.submit([] { return 7; }).get(), 7);
+}
+
+TEST(TripleBufferTest, ReaderSeesWholeFramesInOrder) {
+  // Every published frame is filled with one value, so a torn frame or a
+  // frame going backwards shows up on the reader side.
+  TripleBuffer<std::vector<int>> buffer;
+  const int frames = 20000;
+  std::thread writer([&] {
+    for (int f = 1; f <= frames; f++) {
+      std::vector<int> &frame = buffer.write_buffer();
+      frame.assign(64, f);
+      buffer.publish();
+    }
+  });
+  int last = 0;
+  while (last < frames) {
+    if (!buffer.update()) {
+      continue;
+    }
+    const std::vector<int> &frame = buffer.read_buffer();
+    ASSERT_EQ(frame.size(), 64);
+    for (int v : frame) {
+      ASSERT_EQ(v, frame[0]);
+    }
+    ASSERT_GT(frame[0], last);
+    last = frame[0];
+  }
+  writer.join();
+  EXPECT_FALSE(buffer.update());
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,57 @@
+#include "cloth_world.h"
+
+#include <algorithm>
+
+ClothWorld::ClothWorld(int num_threads)
+    : pool(num_threads), ball_center(0.5f, 1.8f, 0.5f), ball_radius(0.25f),
+      wind(false), split_threshold(128 * 128) {}
+
+Cloth *ClothWorld::add_cloth(std::unique_ptr<Cloth> cloth) {
+  cloth->get_colliders().set_shared(&colliders);
+  cloths.push_back(std::move(cloth));
+  order.push_back((int)cloths.size() - 1);
+  // Start the big cloths first so the small ones fill in around them
+  std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+    return cloths[a]->get_row_count() * cloths[a]->get_col_count() >
+           cloths[b]->get_row_count() * cloths[b]->get_col_count();
+  });
+  assign_pools();
+  return cloths.back().get();
+}
+
+void ClothWorld::set_ball(glm::vec3 center, float radius) {
+  ball_center = center;
+  ball_radius = radius;
+}
+
+void ClothWorld::ball_control(char input) {
+  apply_ball_control(input, ball_center, ball_radius);
+}
+
+void ClothWorld::set_wind(bool on) { wind = on; }
+
+void ClothWorld::set_split_threshold(int points) {
+  split_threshold = points;
+  assign_pools();
+}
+
+void ClothWorld::assign_pools() {
+  for (std::unique_ptr<Cloth> &cloth : cloths) {
+    int points = cloth->get_row_count() * cloth->get_col_count();
+    cloth->set_thread_pool(points >= split_threshold ? &pool : nullptr);
+  }
+}
+
+void ClothWorld::step() {
+  for (std::unique_ptr<Cloth> &cloth : cloths) {
+    cloth->set_ball(ball_center, ball_radius);
+    cloth->set_wind(wind);
+  }
+  int count = (int)order.size();
+  pool.parallel_for(0, count, count, [&](int first, int last) {
+    for (int i = first; i < last; i++) {
+      cloths[order[i]]->update();
+    }
+  });
+  colliders.end_step();
+}
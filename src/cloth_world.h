@@ -0,0 +1,59 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "cloth.h"
+#include "thread_pool.h"
+
+// Owns a set of cloths that share one ball, one wind switch, a set of
+// colliders and one thread pool, and steps them together. Every step is a single parallel_for with
+// one task per cloth, so many small cloths keep all threads busy. Cloths
+// with at least split_threshold points also split their own passes across
+// the pool (parallel_for nests), the rest run serially inside their task.
+class ClothWorld {
+public:
+  explicit ClothWorld(int num_threads = 0);
+
+  ClothWorld(const ClothWorld &) = delete;
+  ClothWorld &operator=(const ClothWorld &) = delete;
+
+  // Takes ownership of the cloth and returns it for further setup. The
+  // cloth's own thread settings are replaced by the world's.
+  Cloth *add_cloth(std::unique_ptr<Cloth> cloth);
+  int cloth_count() const { return (int)cloths.size(); }
+  Cloth *get_cloth(int i) { return cloths[i].get(); }
+
+  void set_ball(glm::vec3 center, float radius);
+  glm::vec3 get_ball_center() const { return ball_center; }
+  float get_ball_radius() const { return ball_radius; }
+  // Same controls as Cloth::ball_control, applied to the shared ball
+  void ball_control(char input);
+  void set_wind(bool on);
+  bool get_wind() const { return wind; }
+  // Colliders every cloth collides with besides the ball. Add and move
+  // them between steps; moves are swept over the next step like a cloth's
+  // own colliders.
+  ColliderSet &get_colliders() { return colliders; }
+
+  void set_split_threshold(int points);
+  int get_split_threshold() const { return split_threshold; }
+  ThreadPool &get_thread_pool() { return pool; }
+
+  // Advances every cloth by one update of its own mode
+  void step();
+
+private:
+  ThreadPool pool;
+  std::vector<std::unique_ptr<Cloth>> cloths;
+  std::vector<int> order; // cloth indices, largest cloth first
+  glm::vec3 ball_center;
+  float ball_radius;
+  bool wind;
+  ColliderSet colliders;
+  int split_threshold;
+
+  void assign_pools();
+};
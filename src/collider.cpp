@@ -0,0 +1,205 @@
+#include "collider.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "binary_io.h"
+
+static glm::vec3 closest_on_segment(const glm::vec3 &a, const glm::vec3 &b,
+                                    const glm::vec3 &p) {
+  glm::vec3 ab = b - a;
+  float length2 = glm::dot(ab, ab);
+  if (length2 == 0.0f) {
+    return a;
+  }
+  float t = glm::clamp(glm::dot(p - a, ab) / length2, 0.0f, 1.0f);
+  return a + t * ab;
+}
+
+// A particle moving from prev to p against a sphere moving from (c0, r0)
+// to (c1, r1) over the same time. In the sphere's frame the particle
+// moves along s(t) = s0 + t * (s1 - s0), so the first contact is the
+// smallest t in [0, 1] with |s(t)| = r0 + t * (r1 - r0), a quadratic.
+static void sweep_sphere(const glm::vec3 &prev, glm::vec3 &p,
+                         const glm::vec3 &c0, float r0, const glm::vec3 &c1,
+                         float r1) {
+  glm::vec3 s0 = prev - c0;
+  glm::vec3 s1 = p - c1;
+  float c = glm::dot(s0, s0) - r0 * r0;
+  if (c < 0.0f) {
+    // Already inside at the start, just push out of the final sphere
+    float length = glm::length(s1);
+    if (length < r1 && length > 0.0f) {
+      p = c1 + s1 * (r1 / length);
+    }
+    return;
+  }
+
+  glm::vec3 d = s1 - s0;
+  float dr = r1 - r0;
+  float a = glm::dot(d, d) - dr * dr;
+  float b = 2.0f * (glm::dot(s0, d) - r0 * dr);
+  float t = 2.0f;
+  if (std::abs(a) < 1e-12f) {
+    if (b < 0.0f) {
+      t = -c / b;
+    }
+  } else {
+    float discriminant = b * b - 4.0f * a * c;
+    if (discriminant >= 0.0f) {
+      float root = std::sqrt(discriminant);
+      float t_a = (-b - root) / (2.0f * a);
+      float t_b = (-b + root) / (2.0f * a);
+      if (t_a > t_b) {
+        std::swap(t_a, t_b);
+      }
+      t = t_a >= 0.0f ? t_a : t_b;
+    }
+  }
+  if (t < 0.0f || t > 1.0f) {
+    return;
+  }
+
+  glm::vec3 contact = s0 + t * d;
+  float length = glm::length(contact);
+  if (length == 0.0f) {
+    return;
+  }
+  p = c1 + contact * (r1 / length);
+}
+
+int ColliderSet::add_sphere(glm::vec3 center, float radius) {
+  spheres.push_back({center, radius, center, radius});
+  return (int)spheres.size() - 1;
+}
+
+int ColliderSet::add_capsule(glm::vec3 a, glm::vec3 b, float radius) {
+  capsules.push_back({a, b, radius, a, b});
+  return (int)capsules.size() - 1;
+}
+
+int ColliderSet::add_plane(glm::vec3 normal, glm::vec3 point) {
+  normal = glm::normalize(normal);
+  planes.push_back({normal, glm::dot(normal, point)});
+  return (int)planes.size() - 1;
+}
+
+int ColliderSet::add_mesh(const TriangleBVH *bvh, float thickness) {
+  meshes.push_back({bvh, thickness});
+  return (int)meshes.size() - 1;
+}
+
+void ColliderSet::move_sphere(int i, glm::vec3 center, float radius) {
+  spheres[i].center = center;
+  spheres[i].radius = radius;
+}
+
+void ColliderSet::move_capsule(int i, glm::vec3 a, glm::vec3 b) {
+  capsules[i].a = a;
+  capsules[i].b = b;
+}
+
+void ColliderSet::clear() {
+  spheres.clear();
+  capsules.clear();
+  planes.clear();
+  meshes.clear();
+}
+
+void ColliderSet::end_step() {
+  for (SphereCollider &s : spheres) {
+    s.prev_center = s.center;
+    s.prev_radius = s.radius;
+  }
+  for (CapsuleCollider &c : capsules) {
+    c.prev_a = c.a;
+    c.prev_b = c.b;
+  }
+}
+
+bool ColliderSet::moving() const {
+  for (const SphereCollider &s : spheres) {
+    if (s.center != s.prev_center || s.radius != s.prev_radius) {
+      return true;
+    }
+  }
+  for (const CapsuleCollider &c : capsules) {
+    if (c.a != c.prev_a || c.b != c.prev_b) {
+      return true;
+    }
+  }
+  return shared != nullptr && shared->moving();
+}
+
+void ColliderSet::collide(const glm::vec3 &prev, glm::vec3 &p, float t0,
+                          float t1) const {
+  for (const SphereCollider &s : spheres) {
+    sweep_sphere(prev, p, glm::mix(s.prev_center, s.center, t0),
+                 glm::mix(s.prev_radius, s.radius, t0),
+                 glm::mix(s.prev_center, s.center, t1),
+                 glm::mix(s.prev_radius, s.radius, t1));
+  }
+  // A capsule is swept as the sphere around its point closest to the
+  // particle, at the start and at the end of the slice.
+  for (const CapsuleCollider &c : capsules) {
+    glm::vec3 start = closest_on_segment(glm::mix(c.prev_a, c.a, t0),
+                                         glm::mix(c.prev_b, c.b, t0), prev);
+    glm::vec3 end = closest_on_segment(glm::mix(c.prev_a, c.a, t1),
+                                       glm::mix(c.prev_b, c.b, t1), p);
+    sweep_sphere(prev, p, start, c.radius, end, c.radius);
+  }
+  for (const PlaneCollider &plane : planes) {
+    float depth = plane.offset - glm::dot(plane.normal, p);
+    if (depth > 0.0f) {
+      p += depth * plane.normal;
+    }
+  }
+  for (const MeshCollider &mesh : meshes) {
+    mesh.bvh->collide(prev, p, mesh.thickness);
+  }
+  if (shared != nullptr) {
+    shared->collide(prev, p, t0, t1);
+  }
+}
+
+bool ColliderSet::near_moving(const glm::vec3 &p, float margin) const {
+  // Conservative: a sphere around everything the collider covered
+  for (const SphereCollider &s : spheres) {
+    if (s.center == s.prev_center && s.radius == s.prev_radius) {
+      continue;
+    }
+    glm::vec3 middle = 0.5f * (s.center + s.prev_center);
+    float reach = 0.5f * glm::length(s.center - s.prev_center) +
+                  std::max(s.radius, s.prev_radius) + margin;
+    if (glm::length(p - middle) < reach) {
+      return true;
+    }
+  }
+  for (const CapsuleCollider &c : capsules) {
+    if (c.a == c.prev_a && c.b == c.prev_b) {
+      continue;
+    }
+    glm::vec3 middle = 0.25f * (c.a + c.b + c.prev_a + c.prev_b);
+    float reach = std::max(
+        std::max(glm::length(c.a - middle), glm::length(c.b - middle)),
+        std::max(glm::length(c.prev_a - middle),
+                 glm::length(c.prev_b - middle)));
+    if (glm::length(p - middle) < reach + c.radius + margin) {
+      return true;
+    }
+  }
+  return shared != nullptr && shared->near_moving(p, margin);
+}
+
+void ColliderSet::write(std::ostream &out) const {
+  write_vector(out, spheres);
+  write_vector(out, capsules);
+  write_vector(out, planes);
+}
+
+void ColliderSet::read(std::istream &in) {
+  const uint64_t max_colliders = 1 << 16;
+  read_vector(in, spheres, max_colliders);
+  read_vector(in, capsules, max_colliders);
+  read_vector(in, planes, max_colliders);
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <istream>
+#include <ostream>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "bvh.h"
+
+// Solid shapes the cloth collides with. Spheres and capsules remember
+// where they were at the end of the last step, so collisions can follow
+// the particle and the collider over the whole step instead of only
+// checking where both ended up.
+struct SphereCollider {
+  glm::vec3 center;
+  float radius;
+  glm::vec3 prev_center;
+  float prev_radius;
+};
+
+struct CapsuleCollider {
+  glm::vec3 a;
+  glm::vec3 b;
+  float radius;
+  glm::vec3 prev_a;
+  glm::vec3 prev_b;
+};
+
+// Half space; points with dot(normal, p) < offset are inside.
+struct PlaneCollider {
+  glm::vec3 normal;
+  float offset;
+};
+
+// Triangle mesh placed by whoever owns the BVH, e.g. a ModelCollider.
+// Particles stay thickness away from its surface.
+struct MeshCollider {
+  const TriangleBVH *bvh;
+  float thickness;
+};
+
+class ColliderSet {
+public:
+  // Each add returns the index to move the collider with later. New
+  // colliders start out at rest.
+  int add_sphere(glm::vec3 center, float radius);
+  int add_capsule(glm::vec3 a, glm::vec3 b, float radius);
+  int add_plane(glm::vec3 normal, glm::vec3 point);
+  // The BVH is not owned and must outlive the set. Refit it between
+  // cloth updates only; sleeping cloth does not notice, so wake it if the
+  // mesh moved into it.
+  int add_mesh(const TriangleBVH *bvh, float thickness);
+  void move_sphere(int i, glm::vec3 center, float radius);
+  void move_capsule(int i, glm::vec3 a, glm::vec3 b);
+  void clear();
+  // Colliders owned by someone else that count as part of this set, e.g.
+  // the ones a ClothWorld shares between its cloths. They are not
+  // written, read or cleared, and their owner calls end_step() on them.
+  void set_shared(const ColliderSet *shared) { this->shared = shared; }
+  const ColliderSet *get_shared() const { return shared; }
+
+  const std::vector<SphereCollider> &get_spheres() const { return spheres; }
+  const std::vector<CapsuleCollider> &get_capsules() const {
+    return capsules;
+  }
+  const std::vector<PlaneCollider> &get_planes() const { return planes; }
+  const std::vector<MeshCollider> &get_meshes() const { return meshes; }
+
+  // Called once the cloth finished a step: the current placement becomes
+  // the one the next step sweeps from.
+  void end_step();
+  // True if a sphere or capsule moved since the last end_step()
+  bool moving() const;
+
+  // Resolves a particle that moved from prev to p during the fraction
+  // [t0, t1] of the step, with the colliders interpolated accordingly
+  // (substeps pass their slice of the step). Against moving spheres and
+  // capsules the first contact along the relative path is used, so a
+  // fast collider cannot jump over the particle; the particle is then
+  // carried along at the collider's surface. Planes are static and only
+  // project p out. Meshes stop the particle's own path at their surface.
+  void collide(const glm::vec3 &prev, glm::vec3 &p, float t0,
+               float t1) const;
+
+  // True if p is within margin of the volume a collider swept through
+  // since the last end_step()
+  bool near_moving(const glm::vec3 &p, float margin) const;
+
+  // Snapshot of the spheres, capsules and planes, previous placements
+  // included. Meshes belong to someone else and are neither written nor
+  // replaced by read().
+  void write(std::ostream &out) const;
+  void read(std::istream &in);
+
+private:
+  std::vector<SphereCollider> spheres;
+  std::vector<CapsuleCollider> capsules;
+  std::vector<PlaneCollider> planes;
+  std::vector<MeshCollider> meshes;
+  const ColliderSet *shared = nullptr;
+};
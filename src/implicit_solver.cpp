@@ -0,0 +1,148 @@
+#include "implicit_solver.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Dot products are summed per block of this many points and the blocks are
+// added up in order, so the result does not depend on the thread count.
+static const int kBlockSize = 256;
+
+template <typename F>
+void ImplicitSolver::for_each_range(ThreadPool *pool, int count, const F &fn) {
+  if (pool == nullptr) {
+    fn(0, count);
+  } else {
+    // Small enough for std::function to hold without allocating
+    pool->parallel_for(0, count, [&fn](int first, int last) {
+      fn(first, last);
+    });
+  }
+}
+
+void ImplicitSolver::assemble(const SpringSystem &s, float h,
+                              ThreadPool *pool) {
+  int spring_count = s.offsets[s.count];
+  diag.resize(s.count);
+  diag_inv.resize(s.count);
+  offdiag.resize(spring_count);
+  rhs.resize(s.count);
+
+  float h2 = h * h;
+  const glm::mat3 identity(1.0f);
+  for_each_range(pool, s.count, [&](int first, int last) {
+    for (int i = first; i < last; i++) {
+      glm::mat3 a_ii = identity * s.vertex_mass;
+      glm::vec3 force = s.external_force[i];
+      glm::vec3 kv = glm::vec3(0);
+      for (int e = s.offsets[i]; e < s.offsets[i + 1]; e++) {
+        int j = s.neighbors[e];
+        glm::vec3 d = s.pos[j] - s.pos[i];
+        float l = glm::length(d);
+        glm::vec3 n = d / l;
+        force += s.k * (l - s.rest[e]) * n;
+
+        // df_i/dx_j of the spring. The transverse part is dropped for
+        // compressed springs so that A stays positive definite.
+        glm::mat3 nn = glm::outerProduct(n, n);
+        float transverse = std::max(0.0f, 1.0f - s.rest[e] / l);
+        glm::mat3 ks = s.k * (nn + transverse * (identity - nn));
+
+        a_ii += h2 * ks;
+        offdiag[e] = -h2 * ks;
+        kv += ks * (s.vel[j] - s.vel[i]);
+      }
+      diag[i] = a_ii;
+      diag_inv[i] = glm::inverse(a_ii);
+      rhs[i] = s.pinned[i] ? glm::vec3(0) : h * (force + h * kv);
+    }
+  });
+}
+
+void ImplicitSolver::multiply(const SpringSystem &s,
+                              const std::vector<glm::vec3> &x,
+                              std::vector<glm::vec3> &out, ThreadPool *pool) {
+  for_each_range(pool, s.count, [&](int first, int last) {
+    for (int i = first; i < last; i++) {
+      if (s.pinned[i]) {
+        out[i] = glm::vec3(0);
+        continue;
+      }
+      glm::vec3 sum = diag[i] * x[i];
+      for (int e = s.offsets[i]; e < s.offsets[i + 1]; e++) {
+        sum += offdiag[e] * x[s.neighbors[e]];
+      }
+      out[i] = sum;
+    }
+  });
+}
+
+double ImplicitSolver::dot(const std::vector<glm::vec3> &a,
+                           const std::vector<glm::vec3> &b, ThreadPool *pool) {
+  int count = a.size();
+  int blocks = (count + kBlockSize - 1) / kBlockSize;
+  partial.resize(blocks);
+  for_each_range(pool, blocks, [&](int first, int last) {
+    for (int blk = first; blk < last; blk++) {
+      double sum = 0;
+      int end = std::min(count, (blk + 1) * kBlockSize);
+      for (int i = blk * kBlockSize; i < end; i++) {
+        sum += glm::dot(a[i], b[i]);
+      }
+      partial[blk] = sum;
+    }
+  });
+  double sum = 0;
+  for (double v : partial) {
+    sum += v;
+  }
+  return sum;
+}
+
+int ImplicitSolver::solve(const SpringSystem &s, float h, ThreadPool *pool,
+                          std::vector<glm::vec3> &dv) {
+  assemble(s, h, pool);
+  dv.assign(s.count, glm::vec3(0));
+  r.resize(s.count);
+  z.resize(s.count);
+  p.resize(s.count);
+  ap.resize(s.count);
+
+  // dv starts at zero so the residual is the right hand side. Pinned rows
+  // of rhs are already zero and stay that way.
+  for_each_range(pool, s.count, [&](int first, int last) {
+    for (int i = first; i < last; i++) {
+      r[i] = rhs[i];
+      z[i] = diag_inv[i] * r[i];
+      p[i] = z[i];
+    }
+  });
+  double rz = dot(r, z, pool);
+  double threshold = tolerance * tolerance * dot(rhs, rhs, pool);
+
+  int iteration = 0;
+  while (iteration < max_iterations && dot(r, r, pool) > threshold) {
+    multiply(s, p, ap, pool);
+    double pap = dot(p, ap, pool);
+    if (pap <= 0) {
+      break;
+    }
+    float alpha = rz / pap;
+    for_each_range(pool, s.count, [&](int first, int last) {
+      for (int i = first; i < last; i++) {
+        dv[i] += alpha * p[i];
+        r[i] -= alpha * ap[i];
+        z[i] = s.pinned[i] ? glm::vec3(0) : diag_inv[i] * r[i];
+      }
+    });
+    double rz_next = dot(r, z, pool);
+    float beta = rz_next / rz;
+    rz = rz_next;
+    for_each_range(pool, s.count, [&](int first, int last) {
+      for (int i = first; i < last; i++) {
+        p[i] = z[i] + beta * p[i];
+      }
+    });
+    iteration++;
+  }
+  return iteration;
+}
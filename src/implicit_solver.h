@@ -0,0 +1,58 @@
+#pragma once
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "thread_pool.h"
+
+// A mass-spring system as seen by the implicit solver. Springs are given in
+// CSR form: the springs of point i go to neighbors[offsets[i]..offsets[i+1])
+// with matching rest lengths, and every spring is listed from both ends.
+struct SpringSystem {
+  int count;
+  const glm::vec3 *pos;
+  const glm::vec3 *vel;
+  const glm::vec3 *external_force;
+  const unsigned char *pinned;
+  const int *offsets;
+  const int *neighbors;
+  const float *rest;
+  float vertex_mass;
+  float k;
+};
+
+// Linearised backward Euler step (Baraff & Witkin, "Large Steps in Cloth
+// Simulation"). Solves
+//   (M - h^2 K) dv = h (f + h K v)
+// for the velocity change dv, where K is the spring force Jacobian assembled
+// as 3x3 blocks along the spring graph. The system is solved with conjugate
+// gradient preconditioned by the inverse diagonal blocks; pinned points are
+// filtered out so their dv stays zero.
+class ImplicitSolver {
+public:
+  int max_iterations = 100;
+  float tolerance = 1e-4f; // relative to the norm of the right hand side
+
+  // Returns the number of CG iterations used. pool may be null.
+  int solve(const SpringSystem &system, float h, ThreadPool *pool,
+            std::vector<glm::vec3> &dv);
+
+private:
+  // Block rows of A = M - h^2 K. offdiag lines up with the spring list.
+  std::vector<glm::mat3> diag;
+  std::vector<glm::mat3> diag_inv;
+  std::vector<glm::mat3> offdiag;
+  std::vector<glm::vec3> rhs, r, z, p, ap;
+  std::vector<double> partial;
+
+  void assemble(const SpringSystem &system, float h, ThreadPool *pool);
+  void multiply(const SpringSystem &system, const std::vector<glm::vec3> &x,
+                std::vector<glm::vec3> &out, ThreadPool *pool);
+  double dot(const std::vector<glm::vec3> &a, const std::vector<glm::vec3> &b,
+             ThreadPool *pool);
+  // A template, so the PCG loop does not wrap its lambdas in a
+  // std::function on every pass
+  template <typename F>
+  void for_each_range(ThreadPool *pool, int count, const F &fn);
+};
@@ -1,8 +1,11 @@
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <filesystem>
 #include <functional>
 #include <iostream>
 #include <memory>
+#include <thread>
 #include <vector>
 
 #include "imgui.h"
@@ -29,15 +32,21 @@
 
 #include "camera.h"
 #include "cloth.h"
+#include "cloth_cache.h"
+#include "cloth_renderer.h"
 #include "hand_mesh.h"
 #include "light.h"
 #include "mesh.h"
 #include "misc.h"
 #include "model.h"
+#include "model_collider.h"
 #include "object.h"
 #include "shader.h"
 #include "stb_image.h"
+#include "texture_cache.h"
+#include "texture_loader.h"
 #include "time.h"
+#include "triple_buffer.h"
 
 using namespace std;
 
@@ -48,6 +57,8 @@ class MainContext {
 public:
   static const int HEIGHT = 600;
   static const int WIDTH = 800;
+  // Textures uploaded per frame while they load, to keep frames smooth
+  static const int TEXTURE_UPLOADS_PER_FRAME = 4;
 
   GLFWwindow *window;
 
@@ -63,9 +74,14 @@ public:
   bool light_spotlight = false;
   bool pendulumSpotLights = false;
   bool drawBorder = false;
+  // Step physics on its own thread (--physics-thread)
+  bool physics_thread = false;
+  // Play a cache baked by cloth_bake instead of simulating
+  // (--play-cache=path)
+  std::string play_cache;
 
   Timer graphicsTimer;
-  Timer physicsTimer;
+  FixedStepScheduler physicsScheduler;
   Timer inputTimer;
   VirtualClock graphicsClock;
   VirtualClock physicsClock;
@@ -81,7 +97,7 @@ public:
 
   MainContext() {
     graphicsTimer.setIntervalMillis(1000 / 30.0);
-    physicsTimer.setIntervalMillis(1000 / 30.0);
+    physicsScheduler.setStepMillis(1000 / 60.0).setMaxCatchUpSteps(5);
     inputTimer.setIntervalMillis(1000 / 30.0);
   }
 
@@ -91,12 +107,13 @@ public:
     last_time_ms = realtime_ms;
 
     graphicsTimer.tickWithClock(graphicsClock);
-    physicsTimer.tickWithClock(physicsClock);
     inputTimer.tickWithClock(realtimeClock);
     realtimeFrameCounter.tick(realtime_ms);
     _do_input = inputTimer.passed();
     _do_render = graphicsTimer.passed();
-    _do_physics = physicsTimer.passed();
+    // The physics thread ticks the scheduler itself
+    _do_physics =
+        physics_thread ? 0 : physicsScheduler.tickWithClock(physicsClock);
 
     // if (realtimeFrameCounter.tick(realtime_ms)) {
     //  printf("%10.2fs l:%5.0f fps, i:%3.0f fps, r:%3.0f fps, p:%3.0f fps, "
@@ -108,7 +125,13 @@ public:
   }
 
   int do_input() { return _do_input; }
+  // Number of fixed physics steps to run this pass
   int do_physics() { return _do_physics; }
+  // How far rendering is between the last two physics steps. A physics
+  // thread publishes whenever it is done, so its latest frame is drawn as is.
+  float physics_alpha() {
+    return physics_thread ? 1.0f : physicsScheduler.alpha();
+  }
   int do_render() { return _do_render; }
   float delta_time() {
     // return delta_ms;
@@ -150,6 +173,39 @@ private:
   ~Input() {}
 };
 
+// State advanced by the fixed physics steps: the animated lights and the
+// cloth. It is stepped on the main thread, or on a thread of its own with
+// --physics-thread; either way the renderer only sees it through the
+// PhysicsFrames it publishes.
+struct PhysicsScene {
+  vector<Light> spotLights;
+  vector<Light> pointLights;
+  std::unique_ptr<Cloth> cloth;
+  // When set the cloth is not simulated; each step shows the next frame
+  // of the cache, looping at the end
+  std::unique_ptr<ClothCacheReader> clothCache;
+  uint64_t clothCacheFrame = 0;
+
+  // Switches flipped from the input side
+  std::atomic<bool> moveLight{false};
+  std::atomic<bool> pendulumSpotLights{false};
+};
+
+struct PhysicsState {
+  vector<glm::vec3> spotLightPositions;
+  vector<Rotator> spotLightRotations;
+  vector<glm::vec3> pointLightPositions;
+  vector<float> clothPositions;
+  vector<float> clothNormals;
+};
+
+// A published physics step along with the state one step earlier, so the
+// renderer can blend between the two.
+struct PhysicsFrame {
+  PhysicsState previous;
+  PhysicsState current;
+};
+
 std::ostream &operator<<(std::ostream &os, const glm::vec3 &v) {
   os << "(" << v.x << "," << v.y << "," << v.z << ")";
   return os;
@@ -309,13 +365,13 @@ void process_input(MainContext &context, const Input &input, Camera *cam) {
   // cam->process_mouse(x_offset, y_offset);
 }
 
-void updatePendulumSpotLights(MainContext &ctx, vector<Light> &spotLights) {
+void updatePendulumSpotLights(double time_secs, vector<Light> &spotLights) {
   glm::vec3 attachPoint = glm::vec3(0, 5, 0);
   float theta_0s[] = {25, -25, 45, 65};
   float Ls[] = {3, 2, 0.5, 1};
   for (int i = 0; i < spotLights.size(); i++) {
     Light &sl = spotLights[i];
-    float t = ctx.physicsClock.getTimeSecs() * 1.5;
+    float t = time_secs * 1.5;
     float theta_0 = glm::radians(theta_0s[i]);
     float g = 9.81;
     float L = Ls[i];
@@ -329,6 +385,87 @@ void updatePendulumSpotLights(MainContext &ctx, vector<Light> &spotLights) {
   }
 }
 
+void stepPhysics(PhysicsScene &scene, double time_secs) {
+  if (scene.moveLight && scene.pointLights.size() > 0) {
+    scene.pointLights[0].position.move_to(glm::vec3(
+        cos(time_secs * 1.5) * 2.5, 1.25f, sin(time_secs * 1.5) * 2.5));
+  }
+  if (scene.pendulumSpotLights) {
+    updatePendulumSpotLights(time_secs, scene.spotLights);
+  }
+  if (scene.clothCache) {
+    scene.clothCacheFrame =
+        (scene.clothCacheFrame + 1) % scene.clothCache->get_frame_count();
+  } else {
+    scene.cloth->update();
+  }
+}
+
+void savePhysicsState(const PhysicsScene &scene, PhysicsState &state,
+                      bool normals) {
+  state.spotLightPositions.resize(scene.spotLights.size());
+  state.spotLightRotations.resize(scene.spotLights.size());
+  for (int i = 0; i < scene.spotLights.size(); i++) {
+    state.spotLightPositions[i] = scene.spotLights[i].position.pos;
+    state.spotLightRotations[i] = scene.spotLights[i].rotation;
+  }
+  state.pointLightPositions.resize(scene.pointLights.size());
+  for (int i = 0; i < scene.pointLights.size(); i++) {
+    state.pointLightPositions[i] = scene.pointLights[i].position.pos;
+  }
+  if (scene.clothCache) {
+    scene.clothCache->read_frame(scene.clothCacheFrame, state.clothPositions,
+                                 normals ? &state.clothNormals : nullptr);
+    return;
+  }
+  absl::Span<const float> positions = scene.cloth->get_positions();
+  state.clothPositions.assign(positions.begin(), positions.end());
+  if (normals) {
+    absl::Span<const float> n = scene.cloth->get_normals();
+    state.clothNormals.assign(n.begin(), n.end());
+  }
+}
+
+// Runs the steps that are due and publishes the result, along with the
+// state before the last of them.
+void runPhysicsSteps(PhysicsScene &scene, FixedStepScheduler &scheduler,
+                     int steps, TripleBuffer<PhysicsFrame> &frames) {
+  if (steps <= 0) {
+    return;
+  }
+  PhysicsFrame &frame = frames.write_buffer();
+  double time_secs =
+      scheduler.getSimulatedSecs() - steps * scheduler.getStepSecs();
+  for (int i = 0; i < steps; i++) {
+    if (i == steps - 1) {
+      savePhysicsState(scene, frame.previous, false);
+    }
+    time_secs += scheduler.getStepSecs();
+    stepPhysics(scene, time_secs);
+  }
+  savePhysicsState(scene, frame.current, true);
+  frames.publish();
+}
+
+// Moves the render copies of the lights alpha of the way between the two
+// states of a frame
+void applyPhysicsFrame(const PhysicsFrame &frame, float alpha,
+                       vector<Light> &spotLights, vector<Light> &pointLights) {
+  const PhysicsState &a = frame.previous;
+  const PhysicsState &b = frame.current;
+  for (int i = 0; i < spotLights.size() && i < b.spotLightPositions.size();
+       i++) {
+    spotLights[i].position.pos =
+        glm::mix(a.spotLightPositions[i], b.spotLightPositions[i], alpha);
+    spotLights[i].rotation = b.spotLightRotations[i];
+  }
+  for (int i = 0; i < pointLights.size() && i < b.pointLightPositions.size();
+       i++) {
+    pointLights[i].position.pos =
+        glm::mix(a.pointLightPositions[i], b.pointLightPositions[i], alpha);
+  }
+}
+
 void drawImGui(MainContext &ctx, Camera &cam) {
   // printf("%10.2fs l:%5.0f fps, i:%3.0f fps, r:%3.0f fps, p:%3.0f fps, "
   //     "delta:%8fs\n",
@@ -343,6 +480,10 @@ void drawImGui(MainContext &ctx, Camera &cam) {
   ImGui::Text("l:%5.0f fps, i:%3.0f fps, r:%3.0f fps, p:%3.0f fps",
               ctx.realtimeFrameCounter.fps(), ctx.inputFrameCounter.fps(),
               ctx.graphicsFrameCounter.fps(), ctx.physicsFrameCounter.fps());
+  const TextureCache::Stats &textures = TextureCache::shared().get_stats();
+  ImGui::Text("Textures: %d, %.1f MB, %lld hits, %lld misses",
+              textures.textures, textures.resident_bytes / 1e6,
+              textures.hits, textures.misses);
   ImGui::BeginChild("Camera", ImVec2(250, 100), true);
   ImGui::Text("Camera");
   ImGui::Text(" pos  (%5.2f,%5.2f,%5.2f)", cam.translator.pos.x,
@@ -367,6 +508,16 @@ void drawImGui(MainContext &ctx, Camera &cam) {
 // --------------------------
 
 int main(int argc, char **argv) {
+  MainContext ctx;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--physics-thread") {
+      ctx.physics_thread = true;
+    } else if (arg.rfind("--play-cache=", 0) == 0) {
+      ctx.play_cache = arg.substr(arg.find('=') + 1);
+    }
+  }
+
   if (!glfwInit()) {
     fprintf(stderr, "Failed to initialize GLFW\n");
     getchar();
@@ -380,7 +531,6 @@ int main(int argc, char **argv) {
   glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE); // Important in Mac
   glfwWindowHint(GLFW_RESIZABLE, GL_FALSE);
 
-  MainContext ctx;
   Camera cam;
   cam.reset();
 
@@ -436,9 +586,12 @@ int main(int argc, char **argv) {
   // Load a texture
   // unsigned int texture1 = load_texture("res/container.jpg");
   // unsigned int texture2 = load_texture("res/awesomeface.png");
-  unsigned int texture3 = load_texture("res/container2.png");
-  unsigned int texture4 = load_texture("res/container2_specular.png");
-  unsigned int texture5 = load_texture("res/matrix.jpg");
+  TextureLoader &textureLoader = TextureLoader::shared();
+  textureLoader.set_compression(GLEW_EXT_texture_compression_s3tc);
+  TextureCache &textures = TextureCache::shared();
+  unsigned int texture3 = textures.acquire("res/container2.png");
+  unsigned int texture4 = textures.acquire("res/container2_specular.png");
+  unsigned int texture5 = textures.acquire("res/matrix.jpg");
 
   // Objects and meshes
   Mesh cubeMesh = create_cube_mesh2({
@@ -525,6 +678,77 @@ int main(int argc, char **argv) {
   shader.setInt("numSpotLights", spotLights.size());
   shader.setInt("numPointLights", pointLights.size());
 
+  // Physics scene, starting from copies of the animated lights
+  PhysicsScene scene;
+  for (const Light &l : spotLights) {
+    scene.spotLights.push_back(l);
+  }
+  for (const Light &l : pointLights) {
+    scene.pointLights.push_back(l);
+  }
+  if (!ctx.play_cache.empty()) {
+    scene.clothCache.reset(new ClothCacheReader());
+    if (!scene.clothCache->open(ctx.play_cache) ||
+        scene.clothCache->get_frame_count() == 0 ||
+        !scene.clothCache->has_normals()) {
+      // Needs normals for the lighting; cloth_bake writes them by default
+      fprintf(stderr, "Cannot play cloth cache %s\n",
+              ctx.play_cache.c_str());
+      glfwTerminate();
+      return -1;
+    }
+    // Only used for its triangles while playing
+    scene.cloth.reset(new Cloth(scene.clothCache->get_rows(),
+                                scene.clothCache->get_cols(), 2, true));
+  } else {
+    scene.cloth.reset(new Cloth(32, 32, 2, true));
+  }
+  scene.cloth->set_frame_timestep(ctx.physicsScheduler.getStepSecs());
+  scene.cloth->set_compute_normals(true);
+  scene.cloth->set_wind(true);
+  ClothRenderer clothRenderer(scene.cloth->get_row_count(),
+                              scene.cloth->get_col_count(),
+                              scene.cloth->get_indices(),
+                              {Texture(texture3, "texture_diffuse")});
+  // The cloth hangs along +y in its own space
+  glm::mat4 clothModel = glm::scale(
+      glm::translate(glm::mat4(1.0f), glm::vec3(-0.75f, 1.75f, -1.0f)),
+      glm::vec3(1.5f, -1.5f, 1.5f));
+
+  // The objects stay put, so their colliders are placed in the cloth's
+  // space once
+  vector<std::unique_ptr<ModelCollider>> objectColliders;
+  for (Object &obj : objects) {
+    objectColliders.emplace_back(new ModelCollider(obj));
+    objectColliders.back()->update(glm::inverse(clothModel));
+    scene.cloth->get_colliders().add_mesh(&objectColliders.back()->get_bvh(),
+                                          scene.cloth->get_thickness());
+  }
+
+  TripleBuffer<PhysicsFrame> physicsFrames;
+  savePhysicsState(scene, physicsFrames.write_buffer().previous, false);
+  savePhysicsState(scene, physicsFrames.write_buffer().current, true);
+  physicsFrames.publish();
+  physicsFrames.update();
+
+  std::atomic<bool> physicsRunning{true};
+  std::thread physicsThread;
+  if (ctx.physics_thread) {
+    physicsThread = std::thread([&] {
+      FixedStepScheduler &scheduler = ctx.physicsScheduler;
+      while (physicsRunning) {
+        int steps = scheduler.tickWithClock(ctx.physicsClock);
+        runPhysicsSteps(scene, scheduler, steps, physicsFrames);
+        if (steps == 0) {
+          // Sleep until the next step is due
+          double wait_ms = (1.0 - scheduler.alpha()) * scheduler.getStepMillis();
+          std::this_thread::sleep_for(
+              std::chrono::microseconds((long long)(wait_ms * 1000)));
+        }
+      }
+    });
+  }
+
   // Main loop
   while (!glfwWindowShouldClose(ctx.window)) {
     ctx.updateTime();
@@ -536,39 +760,16 @@ int main(int argc, char **argv) {
       process_input(ctx, *Input::get(), &cam);
     }
 
-    // Physics
-    if (ctx.do_physics()) {
-      if (ctx.physicsFrameCounter.tick(ctx.realtime_ms) && false) {
-        printf("Do physics: fps: %f, time: %f, rate = %f \n",
-               ctx.physicsFrameCounter.fps(),
-               ctx.physicsTimer.getCurrentMillis(), ctx.physicsClock.getRate());
-      }
-      if (ctx.move_light && pointLights.size() > 0) {
-        float time_secs = ctx.physicsClock.getTimeSecs();
-        // float time_secs = current_time_ms / 1000;
-        pointLights[0].position.move_to(glm::vec3(
-            cos(time_secs * 1.5) * 2.5, 1.25f, sin(time_secs * 1.5) * 2.5));
-      }
-      if (ctx.light_spotlight && spotLights.size() > 0) {
-        spotLights[0].position.move_to(
-            (cam.translator.pos - 2.0f * cam.rotator.front()));
-        spotLights[0].rotation = cam.rotator;
-      }
-
-      if (ctx.pendulumSpotLights) {
-        updatePendulumSpotLights(ctx, spotLights);
-      }
-
-      // Update all the lights
-      for (int i = 0; i < dirLights.size(); i++) {
-        dirLights[i].use(&shader, i);
-      }
-      for (int i = 0; i < spotLights.size(); i++) {
-        spotLights[i].use(&shader, i);
-      }
-      for (int i = 0; i < pointLights.size(); i++) {
-        pointLights[i].use(&shader, i);
-      }
+    // Physics, in as many fixed steps as the physics clock has moved
+    scene.moveLight = ctx.move_light;
+    scene.pendulumSpotLights = ctx.pendulumSpotLights;
+    runPhysicsSteps(scene, ctx.physicsScheduler, ctx.do_physics(),
+                    physicsFrames);
+    bool newPhysicsFrame = physicsFrames.update();
+    if (newPhysicsFrame && ctx.physicsFrameCounter.tick(ctx.realtime_ms) &&
+        false) {
+      printf("Do physics: fps: %f, rate = %f \n",
+             ctx.physicsFrameCounter.fps(), ctx.physicsClock.getRate());
     }
 
     // Render
@@ -580,6 +781,9 @@ int main(int argc, char **argv) {
                ctx.graphicsClock.getRate());
       }
 
+      // Textures still loading show their placeholder until then
+      textureLoader.pump(MainContext::TEXTURE_UPLOADS_PER_FRAME);
+
       glClearColor(0, 0, 0, 0);
       //glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER);
       glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
@@ -594,8 +798,29 @@ int main(int argc, char **argv) {
       glEnable(GL_STENCIL_TEST);
       glStencilMask(0xFF); // enable writing to the stencil buffer
 
+      const PhysicsFrame &frame = physicsFrames.read_buffer();
+      float alpha = ctx.physics_alpha();
+      applyPhysicsFrame(frame, alpha, spotLights, pointLights);
+      if (ctx.light_spotlight && spotLights.size() > 0) {
+        spotLights[0].position.move_to(
+            (cam.translator.pos - 2.0f * cam.rotator.front()));
+        spotLights[0].rotation = cam.rotator;
+      }
+      clothRenderer.upload(frame.current.clothPositions,
+                           frame.previous.clothPositions, alpha,
+                           frame.current.clothNormals);
+
       shader.use();
       cam.use(ctx.aspect_ratio(), &shader);
+      for (int i = 0; i < dirLights.size(); i++) {
+        dirLights[i].use(&shader, i);
+      }
+      for (int i = 0; i < spotLights.size(); i++) {
+        spotLights[i].use(&shader, i);
+      }
+      for (int i = 0; i < pointLights.size(); i++) {
+        pointLights[i].use(&shader, i);
+      }
       glStencilOpSeparate(GL_BACK, GL_KEEP, GL_KEEP, GL_KEEP);
       glStencilOpSeparate(GL_FRONT, GL_REPLACE, GL_REPLACE, GL_REPLACE);
       glStencilFuncSeparate(GL_BACK, GL_NEVER, 1, 0xFF); // all fragments should pass the stencil test
@@ -603,6 +828,7 @@ int main(int argc, char **argv) {
       for (Object &obj : objects) {
         obj.draw(shader);
       }
+      clothRenderer.draw(shader, clothModel);
 
       if (ctx.drawBorder) {
         shaderSingleColor.use();
@@ -652,6 +878,11 @@ int main(int argc, char **argv) {
     glfwPollEvents();
   }
 
+  physicsRunning = false;
+  if (physicsThread.joinable()) {
+    physicsThread.join();
+  }
+
   ImGui_ImplOpenGL3_Shutdown();
   ImGui_ImplGlfw_Shutdown();
   ImGui::DestroyContext();
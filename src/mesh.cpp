@@ -16,9 +16,9 @@
 Mesh::Mesh(std::vector<Vertex> verts,
        std::vector<unsigned int> indices,
        std::vector<Texture> textures) {
-  this->vertices = verts;
-  this->indices = indices;
-  this->textures = textures;
+  this->vertices = std::move(verts);
+  this->indices = std::move(indices);
+  this->textures = std::move(textures);
   setupMesh();
 }
 
@@ -0,0 +1,254 @@
+#include "mesh_cache.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "binary_io.h"
+
+static const char kMeshCacheMagic[8] = {'M', 'E', 'S', 'H', 'C', 'C', 'H',
+                                        '\0'};
+static const uint32_t kMeshCacheVersion = 1;
+
+static_assert(std::is_trivially_copyable<Vertex>::value,
+              "vertices are stored as raw bytes");
+
+struct MeshCacheHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t vertex_size;
+  uint64_t source_hash;
+  uint32_t import_flags;
+  uint32_t mesh_count;
+};
+static_assert(sizeof(MeshCacheHeader) == 32, "header layout");
+
+// Offsets are from the start of the file, counts in elements
+struct MeshCacheEntry {
+  uint64_t vertex_offset;
+  uint64_t vertex_count;
+  uint64_t index_offset;
+  uint64_t index_count;
+  uint64_t texture_offset;
+  uint64_t texture_bytes;
+};
+
+static uint64_t align8(uint64_t value) { return (value + 7) & ~7ull; }
+
+// Maps a whole file read only. Empty files cannot be mapped.
+static const uint8_t *map_file(const std::string &path, size_t &size) {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return nullptr;
+  }
+  struct stat st;
+  void *p = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  ::close(fd);
+  if (p == MAP_FAILED) {
+    return nullptr;
+  }
+  size = st.st_size;
+  return (const uint8_t *)p;
+}
+
+uint64_t hash_file(const std::string &path) {
+  size_t size = 0;
+  const uint8_t *bytes = map_file(path, size);
+  if (bytes == nullptr) {
+    return 0;
+  }
+  uint64_t hash = 14695981039346656037ull;
+  for (size_t i = 0; i < size; i++) {
+    hash = (hash ^ bytes[i]) * 1099511628211ull;
+  }
+  munmap((void *)bytes, size);
+  return hash;
+}
+
+static std::string texture_block(const Mesh &mesh) {
+  std::string block;
+  for (const Texture &texture : mesh.textures) {
+    block += texture.type;
+    block += '\0';
+    block += texture.textureName;
+    block += '\0';
+  }
+  return block;
+}
+
+static void pad_to(std::ostream &out, uint64_t &written, uint64_t offset) {
+  while (written < offset) {
+    out.put('\0');
+    written++;
+  }
+}
+
+bool write_mesh_cache(const std::string &path, uint64_t source_hash,
+                      uint32_t import_flags, const std::vector<Mesh> &meshes) {
+  std::vector<std::string> blocks;
+  for (const Mesh &mesh : meshes) {
+    blocks.push_back(texture_block(mesh));
+  }
+
+  MeshCacheHeader header;
+  std::memcpy(header.magic, kMeshCacheMagic, sizeof(kMeshCacheMagic));
+  header.version = kMeshCacheVersion;
+  header.vertex_size = sizeof(Vertex);
+  header.source_hash = source_hash;
+  header.import_flags = import_flags;
+  header.mesh_count = meshes.size();
+
+  // Lay out the blobs after the table, each 8 byte aligned
+  std::vector<MeshCacheEntry> table(meshes.size());
+  uint64_t offset = sizeof(header) + table.size() * sizeof(MeshCacheEntry);
+  for (size_t i = 0; i < meshes.size(); i++) {
+    MeshCacheEntry &e = table[i];
+    e.vertex_offset = align8(offset);
+    e.vertex_count = meshes[i].vertices.size();
+    e.index_offset = align8(e.vertex_offset + e.vertex_count * sizeof(Vertex));
+    e.index_count = meshes[i].indices.size();
+    e.texture_offset = e.index_offset + e.index_count * sizeof(unsigned int);
+    e.texture_bytes = blocks[i].size();
+    offset = e.texture_offset + e.texture_bytes;
+  }
+
+  // Through a temporary file of our own, as another process or model may
+  // be writing the same cache
+  std::string temp_path = path + ".XXXXXX";
+  int fd = mkstemp(&temp_path[0]);
+  if (fd < 0) {
+    return false;
+  }
+  // mkstemp makes it private to us; the cache is not
+  fchmod(fd, 0644);
+  ::close(fd);
+  std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+  write_value(out, header);
+  out.write((const char *)table.data(), table.size() * sizeof(MeshCacheEntry));
+  uint64_t written = sizeof(header) + table.size() * sizeof(MeshCacheEntry);
+  for (size_t i = 0; i < meshes.size(); i++) {
+    const Mesh &mesh = meshes[i];
+    pad_to(out, written, table[i].vertex_offset);
+    out.write((const char *)mesh.vertices.data(),
+              mesh.vertices.size() * sizeof(Vertex));
+    written += mesh.vertices.size() * sizeof(Vertex);
+    pad_to(out, written, table[i].index_offset);
+    out.write((const char *)mesh.indices.data(),
+              mesh.indices.size() * sizeof(unsigned int));
+    written += mesh.indices.size() * sizeof(unsigned int);
+    out.write(blocks[i].data(), blocks[i].size());
+    written += blocks[i].size();
+  }
+  out.close();
+  if (!out || std::rename(temp_path.c_str(), path.c_str()) != 0) {
+    std::remove(temp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+MeshCacheReader::~MeshCacheReader() { close(); }
+
+static const MeshCacheHeader &header_of(const uint8_t *data) {
+  return *(const MeshCacheHeader *)data;
+}
+
+static const MeshCacheEntry &entry_of(const uint8_t *data, int mesh) {
+  return ((const MeshCacheEntry *)(data + sizeof(MeshCacheHeader)))[mesh];
+}
+
+// True if count elements of the given size fit at offset
+static bool fits(uint64_t offset, uint64_t count, uint64_t element,
+                 uint64_t size) {
+  return offset <= size && count <= (size - offset) / element;
+}
+
+bool MeshCacheReader::open(const std::string &path, uint64_t source_hash,
+                           uint32_t import_flags) {
+  close();
+  data = map_file(path, size);
+  if (data == nullptr) {
+    return false;
+  }
+  const MeshCacheHeader &h = header_of(data);
+  bool valid =
+      size >= sizeof(MeshCacheHeader) &&
+      std::memcmp(h.magic, kMeshCacheMagic, sizeof(kMeshCacheMagic)) == 0 &&
+      h.version == kMeshCacheVersion && h.vertex_size == sizeof(Vertex) &&
+      h.source_hash == source_hash && h.import_flags == import_flags &&
+      fits(sizeof(MeshCacheHeader), h.mesh_count, sizeof(MeshCacheEntry),
+           size);
+  for (uint32_t i = 0; valid && i < h.mesh_count; i++) {
+    const MeshCacheEntry &e = entry_of(data, i);
+    valid = e.vertex_offset % alignof(Vertex) == 0 &&
+            e.index_offset % alignof(unsigned int) == 0 &&
+            fits(e.vertex_offset, e.vertex_count, sizeof(Vertex), size) &&
+            fits(e.index_offset, e.index_count, sizeof(unsigned int), size) &&
+            fits(e.texture_offset, e.texture_bytes, 1, size) &&
+            (e.texture_bytes == 0 ||
+             data[e.texture_offset + e.texture_bytes - 1] == '\0');
+    // Indices go straight to the GPU, so make sure none points past the
+    // vertices
+    const unsigned int *indices = (const unsigned int *)(data + e.index_offset);
+    for (uint64_t j = 0; valid && j < e.index_count; j++) {
+      valid = indices[j] < e.vertex_count;
+    }
+  }
+  if (!valid) {
+    close();
+  }
+  return valid;
+}
+
+void MeshCacheReader::close() {
+  if (data != nullptr) {
+    munmap((void *)data, size);
+  }
+  data = nullptr;
+  size = 0;
+}
+
+int MeshCacheReader::get_mesh_count() const {
+  return data == nullptr ? 0 : header_of(data).mesh_count;
+}
+
+absl::Span<const Vertex> MeshCacheReader::get_vertices(int mesh) const {
+  const MeshCacheEntry &e = entry_of(data, mesh);
+  return absl::Span<const Vertex>((const Vertex *)(data + e.vertex_offset),
+                                  e.vertex_count);
+}
+
+absl::Span<const unsigned int> MeshCacheReader::get_indices(int mesh) const {
+  const MeshCacheEntry &e = entry_of(data, mesh);
+  return absl::Span<const unsigned int>(
+      (const unsigned int *)(data + e.index_offset), e.index_count);
+}
+
+std::vector<std::pair<std::string, std::string>>
+MeshCacheReader::get_textures(int mesh) const {
+  const MeshCacheEntry &e = entry_of(data, mesh);
+  std::vector<std::pair<std::string, std::string>> textures;
+  const char *p = (const char *)(data + e.texture_offset);
+  const char *end = p + e.texture_bytes;
+  while (p < end) {
+    std::string type = p;
+    p += type.size() + 1;
+    if (p >= end) {
+      break;
+    }
+    std::string name = p;
+    p += name.size() + 1;
+    textures.emplace_back(type, name);
+  }
+  return textures;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/types/span.h"
+
+#include "mesh.h"
+
+// Processed meshes of a model file, so later launches can skip Assimp.
+// The file is a header, a table with one entry per mesh, then per mesh
+// its Vertex array and unsigned int indices exactly as they go to the GPU
+// and its texture references as (type, file name) pairs.
+//
+// A cache belongs to one version of one source file: it records a hash
+// of the source's bytes and the Assimp flags it was imported with, and
+// open() refuses it when either differs. Files the source refers to, like
+// an OBJ's .mtl, are not part of the hash.
+
+// FNV-1a of the file's contents, 0 if it cannot be read
+uint64_t hash_file(const std::string &path);
+
+// Writes meshes to path, through a temporary file so a crash never leaves
+// a half written cache behind
+bool write_mesh_cache(const std::string &path, uint64_t source_hash,
+                      uint32_t import_flags, const std::vector<Mesh> &meshes);
+
+class MeshCacheReader {
+public:
+  MeshCacheReader() = default;
+  ~MeshCacheReader();
+  MeshCacheReader(const MeshCacheReader &) = delete;
+  MeshCacheReader &operator=(const MeshCacheReader &) = delete;
+
+  // Maps the cache read only. False if it is missing, damaged or was made
+  // from other source bytes or flags.
+  bool open(const std::string &path, uint64_t source_hash,
+            uint32_t import_flags);
+  void close();
+
+  bool is_open() const { return data != nullptr; }
+  int get_mesh_count() const;
+  // Point into the mapping; valid until close()
+  absl::Span<const Vertex> get_vertices(int mesh) const;
+  absl::Span<const unsigned int> get_indices(int mesh) const;
+  // (type, file name) of each texture, e.g. ("texture_diffuse", "a.png")
+  std::vector<std::pair<std::string, std::string>>
+  get_textures(int mesh) const;
+
+private:
+  const uint8_t *data = nullptr;
+  size_t size = 0;
+};
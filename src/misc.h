@@ -25,6 +25,8 @@ std::string string_format(const std::string &format, Args... args) {
                      buf.get() + size - 1); // We don't want the '\0' inside
 }
 
+// A reference to the shared texture of the file, see TextureCache. It
+// shows a placeholder until TextureLoader::shared() uploads it.
 unsigned int load_texture(std::string image_filepath);
 
 struct Util {
@@ -1,15 +1,25 @@
 #include "model.h"
 
+#include <algorithm>
 #include <filesystem>
 
 #include <assimp/Importer.hpp>
 #include <assimp/postprocess.h>
 #include <assimp/scene.h>
 
+#include "mesh_cache.h"
 #include "shader.h"
+#include "texture_cache.h"
+#include "thread_pool.h"
 
 using namespace std;
 
+Model::~Model() {
+  for (const auto &texture : textures_loaded) {
+    TextureCache::shared().release(texture.second.id);
+  }
+}
+
 void Model::draw(Shader &shader) {
   for (int i = 0; i < meshes.size(); i++) {
     meshes[i].draw(shader);
@@ -17,48 +27,88 @@ void Model::draw(Shader &shader) {
 }
 
 void Model::loadModel(std::string path) {
+  const unsigned int flags = aiProcess_Triangulate | aiProcess_FlipUVs;
+  directory = path.substr(0, path.find_last_of('/'));
+
+  // The processed meshes are kept next to the model, so only the first
+  // launch after the model changes pays for the import
+  std::string cachePath = path + ".meshcache";
+  uint64_t hash = hash_file(path);
+  MeshCacheReader cache;
+  if (hash != 0 && cache.open(cachePath, hash, flags)) {
+    loadFromCache(cache);
+    return;
+  }
+
   Assimp::Importer import;
-  const aiScene *scene =
-      import.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs);
+  const aiScene *scene = import.ReadFile(path, flags);
 
   if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE ||
       !scene->mRootNode) {
     std::cout << "ERROR::ASSIMP::" << import.GetErrorString() << std::endl;
     return;
   }
-  directory = path.substr(0, path.find_last_of('/'));
 
-  processNode(scene->mRootNode, scene);
+  vector<aiMesh *> found;
+  processNode(scene->mRootNode, scene, found);
+  processMeshes(found, scene);
+  if (hash != 0 && !write_mesh_cache(cachePath, hash, flags, meshes)) {
+    std::cout << "WARNING::MODEL::could not write " << cachePath << std::endl;
+  }
+}
+
+void Model::loadFromCache(const MeshCacheReader &cache) {
+  for (int i = 0; i < cache.get_mesh_count(); i++) {
+    absl::Span<const Vertex> vertices = cache.get_vertices(i);
+    absl::Span<const unsigned int> indices = cache.get_indices(i);
+    vector<Texture> textures;
+    for (const auto &texture : cache.get_textures(i)) {
+      textures.push_back(loadTexture(texture.second, texture.first));
+    }
+    meshes.push_back(
+        Mesh(vector<Vertex>(vertices.begin(), vertices.end()),
+             vector<unsigned int>(indices.begin(), indices.end()),
+             std::move(textures)));
+  }
 }
 
-void Model::processNode(aiNode *node, const aiScene *scene) {
-  // process all the node's meshes (if any)
+void Model::processNode(aiNode *node, const aiScene *scene,
+                        vector<aiMesh *> &found) {
+  // collect all the node's meshes (if any)
   for (unsigned int i = 0; i < node->mNumMeshes; i++) {
-    aiMesh *mesh = scene->mMeshes[node->mMeshes[i]];
-    meshes.push_back(processMesh(mesh, scene));
+    found.push_back(scene->mMeshes[node->mMeshes[i]]);
   }
   // then do the same for each of its children
   for (unsigned int i = 0; i < node->mNumChildren; i++) {
-    processNode(node->mChildren[i], scene);
+    processNode(node->mChildren[i], scene, found);
   }
 }
 
-Mesh Model::processMesh(aiMesh *mesh, const aiScene *scene) {
-  vector<Vertex> vertices(mesh->mNumVertices);
-  vector<unsigned int> indices;
-  vector<Texture> textures;
+// Workers that convert the meshes of a model, shared by all models
+static ThreadPool &loadPool() {
+  static ThreadPool pool;
+  return pool;
+}
 
-  // Process all the vertices
+// Copies the vertices and indices out of Assimp's arrays. Touches
+// nothing but its arguments, so meshes can be converted in parallel.
+static void convertMesh(const aiMesh *mesh, vector<Vertex> &vertices,
+                        vector<unsigned int> &indices) {
+  vertices.resize(mesh->mNumVertices);
   for (unsigned int i = 0; i < mesh->mNumVertices; i++) {
-    Vertex vertex;
+    Vertex &vertex = vertices[i];
 
     vertex.pos.x = mesh->mVertices[i].x;
     vertex.pos.y = mesh->mVertices[i].y;
     vertex.pos.z = mesh->mVertices[i].z;
 
-    vertex.normal.x = mesh->mNormals[i].x;
-    vertex.normal.y = mesh->mNormals[i].y;
-    vertex.normal.z = mesh->mNormals[i].z;
+    if (mesh->mNormals) {
+      vertex.normal.x = mesh->mNormals[i].x;
+      vertex.normal.y = mesh->mNormals[i].y;
+      vertex.normal.z = mesh->mNormals[i].z;
+    } else {
+      vertex.normal = glm::vec3(0.0f, 0.0f, 0.0f);
+    }
 
     if (mesh->mTextureCoords[0]) {
       vertex.texture.x = mesh->mTextureCoords[0][i].x;
@@ -66,19 +116,43 @@ Mesh Model::processMesh(aiMesh *mesh, const aiScene *scene) {
     } else {
       vertex.texture = glm::vec2(0.0f, 0.0f);
     }
-
-    vertices[i] = vertex;
   }
 
-  // Process the meshes
+  size_t count = 0;
+  for (unsigned int i = 0; i < mesh->mNumFaces; i++) {
+    count += mesh->mFaces[i].mNumIndices;
+  }
+  indices.resize(count);
+  unsigned int *out = indices.data();
   for (unsigned int i = 0; i < mesh->mNumFaces; i++) {
-    aiFace face = mesh->mFaces[i];
-    for (unsigned int j = 0; j < face.mNumIndices; j++) {
-      indices.push_back(face.mIndices[j]);
+    const aiFace &face = mesh->mFaces[i];
+    out = std::copy(face.mIndices, face.mIndices + face.mNumIndices, out);
+  }
+}
+
+void Model::processMeshes(const vector<aiMesh *> &found,
+                          const aiScene *scene) {
+  // The conversion is plain CPU work and goes wide, one mesh per band as
+  // their sizes vary a lot. Textures and GL buffers need the context, so
+  // they are made afterwards on this thread.
+  int count = (int)found.size();
+  vector<vector<Vertex>> vertices(count);
+  vector<vector<unsigned int>> indices(count);
+  loadPool().parallel_for(0, count, count, [&](int begin, int end) {
+    for (int i = begin; i < end; i++) {
+      convertMesh(found[i], vertices[i], indices[i]);
     }
+  });
+
+  meshes.reserve(meshes.size() + count);
+  for (int i = 0; i < count; i++) {
+    meshes.push_back(Mesh(std::move(vertices[i]), std::move(indices[i]),
+                          processMaterial(found[i], scene)));
   }
+}
 
-  // Process the materials
+vector<Texture> Model::processMaterial(aiMesh *mesh, const aiScene *scene) {
+  vector<Texture> textures;
   if (mesh->mMaterialIndex >= 0) {
     aiMaterial *material = scene->mMaterials[mesh->mMaterialIndex];
 
@@ -94,8 +168,7 @@ Mesh Model::processMesh(aiMesh *mesh, const aiScene *scene) {
         material, aiTextureType_EMISSIVE, "texture_emission");
     textures.insert(textures.end(), emissionMaps.begin(), emissionMaps.end());
   }
-
-  return Mesh(vertices, indices, textures);
+  return textures;
 }
 
 std::vector<Texture> Model::loadMaterialTextures(aiMaterial *mat,
@@ -105,25 +178,27 @@ std::vector<Texture> Model::loadMaterialTextures(aiMaterial *mat,
   for (unsigned int i = 0; i < mat->GetTextureCount(type); i++) {
     aiString textureFilename;
     mat->GetTexture(type, i, &textureFilename);
-    string textureName = textureFilename.C_Str();
-
-    if (textures_loaded.count(textureName) > 0) {
-      textures.push_back(textures_loaded.at(textureName));
-    } else {
-      std::experimental::filesystem::path p(directory);
-      p /= textureName;
-
-      Texture texture;
-      texture.id = load_texture(p.c_str());
-      texture.type = typeName;
-      texture.textureName = textureName;
-      textures.push_back(texture);
-
-      // optimization, save the texture by its filename so we can re-use
-      // it in the model
-      textures_loaded.insert(
-          std::pair<string, Texture>(texture.textureName, texture));
-    }
+    textures.push_back(loadTexture(textureFilename.C_Str(), typeName));
   }
   return textures;
 }
+
+Texture Model::loadTexture(const std::string &textureName,
+                           const std::string &typeName) {
+  if (textures_loaded.count(textureName) > 0) {
+    return textures_loaded.at(textureName);
+  }
+  std::experimental::filesystem::path p(directory);
+  p /= textureName;
+
+  Texture texture;
+  texture.id = TextureCache::shared().acquire(p.string());
+  texture.type = typeName;
+  texture.textureName = textureName;
+
+  // keep the texture by its filename so the model holds one reference to
+  // it however many meshes use it
+  textures_loaded.insert(
+      std::pair<string, Texture>(texture.textureName, texture));
+  return texture;
+}
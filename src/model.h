@@ -8,13 +8,21 @@
 #include "mesh.h"
 #include "shader.h"
 
+class MeshCacheReader;
 
 class Model {
 public:
   Model(std::string path) { loadModel(path); }
   Model(Mesh mesh) { meshes.push_back(mesh); }
+  // Releases the textures the model loaded; the model's meshes must not
+  // be drawn afterwards
+  ~Model();
+  Model(const Model &) = delete;
+  Model &operator=(const Model &) = delete;
+  Model(Model &&) = default;
 
   void draw(Shader &shader);
+  const std::vector<Mesh> &get_meshes() const { return meshes; }
 
 private:
   std::vector<Mesh> meshes;
@@ -22,8 +30,15 @@ private:
   std::map<std::string, Texture> textures_loaded;
 
   void loadModel(std::string path);
-  void processNode(aiNode *node, const aiScene *scene);
-  Mesh processMesh(aiMesh *mesh, const aiScene *scene);
+  void loadFromCache(const MeshCacheReader &cache);
+  // Collects the meshes below node, depth first
+  void processNode(aiNode *node, const aiScene *scene,
+                   std::vector<aiMesh *> &found);
+  void processMeshes(const std::vector<aiMesh *> &found,
+                     const aiScene *scene);
+  std::vector<Texture> processMaterial(aiMesh *mesh, const aiScene *scene);
   std::vector<Texture> loadMaterialTextures(aiMaterial *mat, aiTextureType type,
                                             std::string typeName);
+  Texture loadTexture(const std::string &textureName,
+                      const std::string &typeName);
 };
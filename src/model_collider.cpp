@@ -0,0 +1,32 @@
+#include "model_collider.h"
+
+#include <vector>
+
+#include "mesh.h"
+
+ModelCollider::ModelCollider(Object &object) : object(object) {
+  // All meshes of the model go into one BVH
+  std::vector<glm::vec3> vertices;
+  std::vector<unsigned int> indices;
+  for (const Mesh &mesh : object.model.get_meshes()) {
+    unsigned int base = vertices.size();
+    for (const Vertex &v : mesh.vertices) {
+      vertices.push_back(v.pos);
+    }
+    for (unsigned int i : mesh.indices) {
+      indices.push_back(base + i);
+    }
+  }
+  bvh.build(vertices, indices);
+}
+
+bool ModelCollider::update(const glm::mat4 &to_space) {
+  glm::mat4 transform = to_space * object.model_matrix();
+  if (fitted && transform == placed) {
+    return false;
+  }
+  bvh.refit(transform);
+  placed = transform;
+  fitted = true;
+  return true;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include "bvh.h"
+#include "object.h"
+
+// Collision geometry of an Object's Model for the cloth. The BVH is built
+// once from the vertices and indices of every mesh in the model; update()
+// refits it whenever the object's transform changes. Add it to a cloth
+// with cloth.get_colliders().add_mesh(&collider.get_bvh(), thickness).
+class ModelCollider {
+public:
+  explicit ModelCollider(Object &object);
+
+  ModelCollider(const ModelCollider &) = delete;
+  ModelCollider &operator=(const ModelCollider &) = delete;
+
+  // Places the mesh at to_space * object.model_matrix(), where to_space
+  // takes world space into the space the cloth simulates in (the inverse
+  // of the cloth's model matrix). Returns true if the BVH was refit.
+  bool update(const glm::mat4 &to_space = glm::mat4(1.0f));
+  const TriangleBVH &get_bvh() const { return bvh; }
+
+private:
+  Object &object;
+  TriangleBVH bvh;
+  glm::mat4 placed;
+  bool fitted = false;
+};
@@ -175,12 +175,16 @@ glm::mat4 Scaler::matrix(glm::mat4 model) {
   return model;
 }
 
-void Object::draw(Shader &shader) {
+glm::mat4 Object::model_matrix() {
   glm::mat4 modelMat = glm::mat4(1.0f);
   modelMat = position.matrix(modelMat);
   modelMat = rotation.matrix(modelMat);
   modelMat = scale.matrix(modelMat);
-  // modelMat = scale.matrix(modelMat);
+  return modelMat;
+}
+
+void Object::draw(Shader &shader) {
+  glm::mat4 modelMat = model_matrix();
 
   shader.setMat4("model", modelMat);
   shader.setMat4("inv_model", glm::inverse(modelMat));
@@ -117,5 +117,6 @@ public:
 
   Object(Model &model) : model(model) {}
 
+  glm::mat4 model_matrix();
   void draw(Shader &shader);
 };
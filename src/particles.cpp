@@ -0,0 +1,25 @@
+/**************************************
+ * particles.cpp
+ */
+
+#include "particles.h"
+
+void Particles::resize(int n) {
+    pos.resize(n);
+    old_pos.resize(n);
+    acc.resize(n);
+    normal.resize(n);
+    pinned.resize(n);
+}
+
+void Particles::add(glm::vec3 p) {
+    pos.push_back(p);
+    old_pos.push_back(p);
+    acc.push_back(glm::vec3(0.0f));
+    normal.push_back(glm::vec3(0.0f));
+    pinned.push_back(0);
+}
+
+int Particles::size() const {
+    return (int)pos.size();
+}
@@ -0,0 +1,28 @@
+/**************************************
+ * particles.h
+ * Structure-of-arrays storage for the
+ * particles of one cloth
+ */
+
+#ifndef PARTICLES_H
+#define PARTICLES_H
+
+#include <vector>
+#include <glm/glm.hpp>
+
+class Particles {
+public:
+    // Each attribute lives in its own contiguous array so the integration
+    // passes only stream through the data they actually touch.
+    std::vector<glm::vec3> pos;
+    std::vector<glm::vec3> old_pos;
+    std::vector<glm::vec3> acc;
+    std::vector<glm::vec3> normal;
+    std::vector<unsigned char> pinned;
+
+    void resize(int n);
+    void add(glm::vec3 p);
+    int size() const;
+};
+
+#endif
@@ -3,31 +3,31 @@
  */
 
 #include <iostream>
-#include <GL/glew.h>
-#include <GLFW/glfw3.h>
 #include "point.h"
 
-Point::Point() {
+Point::Point(Particles &particles, int index)
+    : pos(particles.pos[index]), old_pos(particles.old_pos[index]),
+      particles(particles), index(index) {
 }
 
-Point::Point(float x, float y, float z) {
-    pos = glm::vec3(x, y, z); 
-    old_pos = glm::vec3(x, y, z);
-    pined = false;
-    force = glm::vec3(0.0f);
-    //acceleration = glm::vec3(0.0f);
+bool Point::is_pined() {
+    return particles.pinned[index] != 0;
 }
 
-void Point::set_index(int i) {
-    index = i;
+void Point::set_pined(bool p) {
+    particles.pinned[index] = p ? 1 : 0;
+}
+
+int Point::get_index() {
+    return index;
 }
 
 void Point::set_acc(glm::vec3 acc) {
-    acceleration = acc;
+    particles.acc[index] = acc;
 }
 
 glm::vec3 Point::get_acc() {
-    return acceleration;
+    return particles.acc[index];
 }
 
 std::vector<int> Point::get_s_neighbors(int i, int col_count, int row_count) {
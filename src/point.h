@@ -1,32 +1,30 @@
 /***************************************
  * point.h
- * The point class which maintains
- * the attributes in one point in the cloth
+ * A view onto one point of a cloth. The
+ * attributes themselves live in Particles.
  */
 
 #ifndef POINT_H
 #define POINT_H
 
-#include <GL/glew.h>
 #include <glm/glm.hpp>
 #include <vector>
+#include "particles.h"
 
 class Point {
 public:
-    Point();
-    Point(float, float, float);
-    glm::vec3 pos;
-    glm::vec3 old_pos;
-    glm::vec3 force;
-    bool pined;
-    void set_index(int);
+    Point(Particles &particles, int index);
+    glm::vec3 &pos;
+    glm::vec3 &old_pos;
+    bool is_pined();
+    void set_pined(bool);
+    int get_index();
     void set_acc(glm::vec3);
     glm::vec3 get_acc();
-    std::vector<int> get_s_neighbors(int i, int col_count, int row_count);
-    std::vector<int> get_d_neighbors(int i, int col_count, int row_count);
+    static std::vector<int> get_s_neighbors(int i, int col_count, int row_count);
+    static std::vector<int> get_d_neighbors(int i, int col_count, int row_count);
 private:
-    glm::vec3 acceleration;
-    glm::vec3 color;
+    Particles &particles;
     int index;
 };
 
@@ -0,0 +1,121 @@
+#include "spatial_hash.h"
+
+#include <algorithm>
+
+SpatialHash::SpatialHash(float spacing, int table_size)
+    : spacing(spacing), table_size(std::max(1, table_size)) {
+  cell_start.assign(this->table_size + 1, 0);
+}
+
+void SpatialHash::set_spacing(float s) {
+  if (s > 0.0f) {
+    spacing = s;
+  }
+}
+
+void SpatialHash::build(const glm::vec3 *pos, int count, ThreadPool *pool) {
+  table_size = std::max(1, 2 * count);
+  int bands = pool == nullptr ? 1 : pool->size();
+  // Calls fn(first, last) over [0, n) on the pool, in one band per thread
+  // when bands_only is set
+  auto for_each = [&](int n, bool bands_only, const auto &fn) {
+    if (pool == nullptr) {
+      fn(0, n);
+    } else {
+      pool->parallel_for(0, n, bands_only ? n : pool->size(),
+                         [&fn](int first, int last) { fn(first, last); });
+    }
+  };
+  // Locked increments stall on every cache miss, so a serial build uses
+  // plain loads and stores instead
+  bool shared = pool != nullptr;
+  auto increment = [shared](std::atomic<int> &value) {
+    if (!shared) {
+      int old = value.load(std::memory_order_relaxed);
+      value.store(old + 1, std::memory_order_relaxed);
+      return old;
+    }
+    return value.fetch_add(1, std::memory_order_relaxed);
+  };
+  auto band_first = [&](int band) {
+    return (int)((long long)table_size * band / bands);
+  };
+
+  // Counting sort with one shared count per bucket. Points are counted and
+  // scattered with atomic increments, the prefix sum goes over bands of
+  // buckets, and every bucket is sorted at the end so it holds its points
+  // in index order and queries visit them in the same order whatever the
+  // thread count.
+  if (cell_fill_size < table_size) {
+    cell_fill.reset(new std::atomic<int>[table_size]);
+    cell_fill_size = table_size;
+  }
+  point_hash.resize(count);
+  cell_start.resize(table_size + 1);
+  cell_entries.resize(count);
+  // Plain pointers, as the compiler reloads members after every atomic
+  std::atomic<int> *fill = cell_fill.get();
+  int *hashes = point_hash.data();
+  int *starts = cell_start.data();
+  int *entries = cell_entries.data();
+  for_each(table_size, false, [&](int first, int last) {
+    for (int h = first; h < last; h++) {
+      fill[h].store(0, std::memory_order_relaxed);
+    }
+  });
+  for_each(count, false, [&](int first, int last) {
+    for (int i = first; i < last; i++) {
+      hashes[i] = hash_cell(cell_coord(pos[i].x), cell_coord(pos[i].y),
+                            cell_coord(pos[i].z));
+    }
+    for (int i = first; i < last; i++) {
+      increment(fill[hashes[i]]);
+    }
+  });
+
+  range_totals.resize(bands + 1);
+  range_totals[0] = 0;
+  for_each(bands, true, [&](int first, int last) {
+    for (int r = first; r < last; r++) {
+      int total = 0;
+      int end = band_first(r + 1);
+      for (int h = band_first(r); h < end; h++) {
+        total += fill[h].load(std::memory_order_relaxed);
+      }
+      range_totals[r + 1] = total;
+    }
+  });
+  for (int r = 0; r < bands; r++) {
+    range_totals[r + 1] += range_totals[r];
+  }
+  // cell_fill turns from counts into the next free slot of each bucket
+  for_each(bands, true, [&](int first, int last) {
+    for (int r = first; r < last; r++) {
+      int offset = range_totals[r];
+      int end = band_first(r + 1);
+      for (int h = band_first(r); h < end; h++) {
+        int n = fill[h].load(std::memory_order_relaxed);
+        starts[h] = offset;
+        fill[h].store(offset, std::memory_order_relaxed);
+        offset += n;
+      }
+    }
+  });
+  cell_start[table_size] = count;
+
+  for_each(count, false, [&](int first, int last) {
+    for (int i = first; i < last; i++) {
+      entries[increment(fill[hashes[i]])] = i;
+    }
+  });
+  if (pool == nullptr) {
+    return;  // Scattered in index order already
+  }
+  for_each(table_size, false, [&](int first, int last) {
+    for (int h = first; h < last; h++) {
+      if (starts[h + 1] - starts[h] > 1) {
+        std::sort(entries + starts[h], entries + starts[h + 1]);
+      }
+    }
+  });
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+#include <cmath>
+#include <memory>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "thread_pool.h"
+
+// Uniform grid of cubic cells hashed into a fixed size table, so memory
+// only depends on the number of points and not on how far they spread.
+// build() is a counting sort of the points by cell and runs in O(N), every
+// pass of it split across the pool.
+class SpatialHash {
+public:
+  SpatialHash(float spacing = 1.0f, int table_size = 1);
+
+  void set_spacing(float spacing);
+  float get_spacing() const { return spacing; }
+
+  // Hashes every point and buckets the point indices by cell, in parallel
+  // when pool is not null. The table grows to twice the point count.
+  void build(const glm::vec3 *pos, int count, ThreadPool *pool);
+
+  // Calls fn(j) for every point j in the 3x3x3 block of cells around p.
+  // Candidates still need a distance check; points from unrelated cells
+  // that share a hash bucket show up too.
+  template <typename F> void query(const glm::vec3 &p, F fn) const {
+    int cx = cell_coord(p.x);
+    int cy = cell_coord(p.y);
+    int cz = cell_coord(p.z);
+    int visited[27];
+    int visited_count = 0;
+    for (int x = cx - 1; x <= cx + 1; x++) {
+      for (int y = cy - 1; y <= cy + 1; y++) {
+        for (int z = cz - 1; z <= cz + 1; z++) {
+          int h = hash_cell(x, y, z);
+          bool seen = false;
+          for (int v = 0; v < visited_count; v++) {
+            seen = seen || visited[v] == h;
+          }
+          if (seen) {
+            continue;
+          }
+          visited[visited_count++] = h;
+          for (int e = cell_start[h]; e < cell_start[h + 1]; e++) {
+            fn(cell_entries[e]);
+          }
+        }
+      }
+    }
+  }
+
+private:
+  float spacing;
+  int table_size;
+  std::vector<int> point_hash;
+  std::vector<int> cell_start;   // table_size + 1 offsets into cell_entries
+  std::vector<int> cell_entries; // point indices sorted by hash
+  // Scratch for the sort: the count and then the next free slot of every
+  // bucket, shared by all threads, and the points held by each band of
+  // buckets
+  std::unique_ptr<std::atomic<int>[]> cell_fill;
+  int cell_fill_size = 0;
+  std::vector<int> range_totals;
+
+  int cell_coord(float v) const { return (int)std::floor(v / spacing); }
+  int hash_cell(int x, int y, int z) const {
+    unsigned int h = (unsigned int)x * 92837111u ^
+                     (unsigned int)y * 689287499u ^
+                     (unsigned int)z * 283923481u;
+    return (int)(h % (unsigned int)table_size);
+  }
+};
@@ -0,0 +1,218 @@
+#include "spring_kernel.h"
+
+#include <cmath>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SPRING_KERNEL_X86 1
+#endif
+
+namespace {
+
+// The 8 springs of a point as (row offset, column offset, diagonal)
+const int kDirections[8][3] = {
+    {-1, 0, 0}, {1, 0, 0},  {0, -1, 0}, {0, 1, 0},
+    {-1, -1, 1}, {1, 1, 1}, {-1, 1, 1}, {1, -1, 1},
+};
+
+// Everything one direction of springs needs for a row: the points of the
+// row itself, the neighbouring row, the column offset of the neighbour and
+// the columns that actually have that neighbour.
+struct Direction {
+  const float *x, *y, *z;
+  const float *nx, *ny, *nz;
+  int dc;
+  int first;
+  int last;
+  float rest;
+};
+
+bool direction(const float *x, const float *y, const float *z, int rows,
+               int cols, int row, int d, float rest, float rest_diag,
+               Direction *out) {
+  int dr = kDirections[d][0];
+  int dc = kDirections[d][1];
+  int neighbor_row = row + dr;
+  if (neighbor_row < 0 || neighbor_row >= rows) {
+    return false;
+  }
+  int offset = row * cols;
+  int neighbor_offset = neighbor_row * cols;
+  out->x = x + offset;
+  out->y = y + offset;
+  out->z = z + offset;
+  out->nx = x + neighbor_offset;
+  out->ny = y + neighbor_offset;
+  out->nz = z + neighbor_offset;
+  out->dc = dc;
+  out->first = dc < 0 ? -dc : 0;
+  out->last = dc > 0 ? cols - dc : cols;
+  out->rest = kDirections[d][2] ? rest_diag : rest;
+  return true;
+}
+
+// f += (n - p) * k * (|n - p| - rest) / |n - p|, one point at a time.
+// The vector kernels use this for the columns left over at the row end.
+void add_springs_scalar(const Direction &dir, int first, float k, float *fx,
+                        float *fy, float *fz) {
+  for (int c = first; c < dir.last; c++) {
+    float dx = dir.nx[c + dir.dc] - dir.x[c];
+    float dy = dir.ny[c + dir.dc] - dir.y[c];
+    float dz = dir.nz[c + dir.dc] - dir.z[c];
+    float len = std::sqrt(dx * dx + dy * dy + dz * dz);
+    float s = k * (len - dir.rest) / len;
+    fx[c] += dx * s;
+    fy[c] += dy * s;
+    fz[c] += dz * s;
+  }
+}
+
+void clear(int cols, float *fx, float *fy, float *fz) {
+  for (int c = 0; c < cols; c++) {
+    fx[c] = 0;
+    fy[c] = 0;
+    fz[c] = 0;
+  }
+}
+
+void row_forces_scalar(const float *x, const float *y, const float *z,
+                       int rows, int cols, int row, float rest,
+                       float rest_diag, float k, float *fx, float *fy,
+                       float *fz) {
+  clear(cols, fx, fy, fz);
+  Direction dir;
+  for (int d = 0; d < 8; d++) {
+    if (direction(x, y, z, rows, cols, row, d, rest, rest_diag, &dir)) {
+      add_springs_scalar(dir, dir.first, k, fx, fy, fz);
+    }
+  }
+}
+
+#ifdef SPRING_KERNEL_X86
+
+void row_forces_sse(const float *x, const float *y, const float *z, int rows,
+                    int cols, int row, float rest, float rest_diag, float k,
+                    float *fx, float *fy, float *fz) {
+  clear(cols, fx, fy, fz);
+  const __m128 kk = _mm_set1_ps(k);
+  Direction dir;
+  for (int d = 0; d < 8; d++) {
+    if (!direction(x, y, z, rows, cols, row, d, rest, rest_diag, &dir)) {
+      continue;
+    }
+    const __m128 rr = _mm_set1_ps(dir.rest);
+    int c = dir.first;
+    for (; c + 4 <= dir.last; c += 4) {
+      __m128 dx = _mm_sub_ps(_mm_loadu_ps(dir.nx + c + dir.dc),
+                             _mm_loadu_ps(dir.x + c));
+      __m128 dy = _mm_sub_ps(_mm_loadu_ps(dir.ny + c + dir.dc),
+                             _mm_loadu_ps(dir.y + c));
+      __m128 dz = _mm_sub_ps(_mm_loadu_ps(dir.nz + c + dir.dc),
+                             _mm_loadu_ps(dir.z + c));
+      __m128 len2 = _mm_add_ps(
+          _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)),
+          _mm_mul_ps(dz, dz));
+      __m128 len = _mm_sqrt_ps(len2);
+      __m128 s = _mm_div_ps(_mm_mul_ps(kk, _mm_sub_ps(len, rr)), len);
+      _mm_storeu_ps(fx + c,
+                    _mm_add_ps(_mm_loadu_ps(fx + c), _mm_mul_ps(dx, s)));
+      _mm_storeu_ps(fy + c,
+                    _mm_add_ps(_mm_loadu_ps(fy + c), _mm_mul_ps(dy, s)));
+      _mm_storeu_ps(fz + c,
+                    _mm_add_ps(_mm_loadu_ps(fz + c), _mm_mul_ps(dz, s)));
+    }
+    add_springs_scalar(dir, c, k, fx, fy, fz);
+  }
+}
+
+__attribute__((target("avx2"))) void
+row_forces_avx2(const float *x, const float *y, const float *z, int rows,
+                int cols, int row, float rest, float rest_diag, float k,
+                float *fx, float *fy, float *fz) {
+  clear(cols, fx, fy, fz);
+  const __m256 kk = _mm256_set1_ps(k);
+  Direction dir;
+  for (int d = 0; d < 8; d++) {
+    if (!direction(x, y, z, rows, cols, row, d, rest, rest_diag, &dir)) {
+      continue;
+    }
+    const __m256 rr = _mm256_set1_ps(dir.rest);
+    int c = dir.first;
+    for (; c + 8 <= dir.last; c += 8) {
+      __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(dir.nx + c + dir.dc),
+                                _mm256_loadu_ps(dir.x + c));
+      __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(dir.ny + c + dir.dc),
+                                _mm256_loadu_ps(dir.y + c));
+      __m256 dz = _mm256_sub_ps(_mm256_loadu_ps(dir.nz + c + dir.dc),
+                                _mm256_loadu_ps(dir.z + c));
+      __m256 len2 = _mm256_add_ps(
+          _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)),
+          _mm256_mul_ps(dz, dz));
+      __m256 len = _mm256_sqrt_ps(len2);
+      __m256 s = _mm256_div_ps(_mm256_mul_ps(kk, _mm256_sub_ps(len, rr)), len);
+      _mm256_storeu_ps(fx + c, _mm256_add_ps(_mm256_loadu_ps(fx + c),
+                                             _mm256_mul_ps(dx, s)));
+      _mm256_storeu_ps(fy + c, _mm256_add_ps(_mm256_loadu_ps(fy + c),
+                                             _mm256_mul_ps(dy, s)));
+      _mm256_storeu_ps(fz + c, _mm256_add_ps(_mm256_loadu_ps(fz + c),
+                                             _mm256_mul_ps(dz, s)));
+    }
+    add_springs_scalar(dir, c, k, fx, fy, fz);
+  }
+}
+
+#endif
+
+} // namespace
+
+bool spring_kernel_supported(SpringKernel kernel) {
+  switch (kernel) {
+  case SPRING_KERNEL_SCALAR:
+    return true;
+#ifdef SPRING_KERNEL_X86
+  case SPRING_KERNEL_SSE:
+    return __builtin_cpu_supports("sse2");
+  case SPRING_KERNEL_AVX2:
+    return __builtin_cpu_supports("avx2");
+#endif
+  default:
+    return false;
+  }
+}
+
+SpringKernel best_spring_kernel() {
+  static const SpringKernel best = spring_kernel_supported(SPRING_KERNEL_AVX2)
+                                       ? SPRING_KERNEL_AVX2
+                                   : spring_kernel_supported(SPRING_KERNEL_SSE)
+                                       ? SPRING_KERNEL_SSE
+                                       : SPRING_KERNEL_SCALAR;
+  return best;
+}
+
+const char *spring_kernel_name(SpringKernel kernel) {
+  switch (kernel) {
+  case SPRING_KERNEL_SSE:
+    return "sse";
+  case SPRING_KERNEL_AVX2:
+    return "avx2";
+  default:
+    return "scalar";
+  }
+}
+
+void spring_row_forces(SpringKernel kernel, const float *x, const float *y,
+                       const float *z, int rows, int cols, int row,
+                       float rest, float rest_diag, float k, float *fx,
+                       float *fy, float *fz) {
+#ifdef SPRING_KERNEL_X86
+  if (kernel == SPRING_KERNEL_AVX2) {
+    row_forces_avx2(x, y, z, rows, cols, row, rest, rest_diag, k, fx, fy, fz);
+    return;
+  }
+  if (kernel == SPRING_KERNEL_SSE) {
+    row_forces_sse(x, y, z, rows, cols, row, rest, rest_diag, k, fx, fy, fz);
+    return;
+  }
+#endif
+  row_forces_scalar(x, y, z, rows, cols, row, rest, rest_diag, k, fx, fy, fz);
+}
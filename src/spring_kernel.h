@@ -0,0 +1,24 @@
+#pragma once
+
+// Structural and shear spring forces for one row of a regular cloth grid.
+//
+// Positions are passed as separate x/y/z arrays for the whole grid
+// (row-major, `cols` points per row). For every point of `row` the kernel
+// writes the sum of the forces of its (up to) 8 springs into fx/fy/fz,
+// which point at the first point of that row. Straight springs have rest
+// length `rest`, diagonal ones `rest_diag`, all with stiffness `k`.
+enum SpringKernel {
+  SPRING_KERNEL_SCALAR,
+  SPRING_KERNEL_SSE,
+  SPRING_KERNEL_AVX2,
+};
+
+// The fastest kernel the running CPU supports
+SpringKernel best_spring_kernel();
+bool spring_kernel_supported(SpringKernel kernel);
+const char *spring_kernel_name(SpringKernel kernel);
+
+void spring_row_forces(SpringKernel kernel, const float *x, const float *y,
+                       const float *z, int rows, int cols, int row,
+                       float rest, float rest_diag, float k, float *fx,
+                       float *fy, float *fz);
@@ -0,0 +1,79 @@
+#include "texture_cache.h"
+
+#include <experimental/filesystem>
+#include <system_error>
+
+#include <GLFW/glfw3.h>
+
+namespace fs = std::experimental::filesystem;
+
+// Missing files keep their absolute path, so they still share one entry
+// (and one placeholder)
+static std::string canonical_path(const std::string &path) {
+  std::error_code error;
+  fs::path canonical = fs::canonical(path, error);
+  if (error) {
+    return fs::absolute(path).string();
+  }
+  return canonical.string();
+}
+
+TextureCache::TextureCache(TextureLoader &loader) : loader(loader) {}
+
+TextureCache &TextureCache::shared() {
+  static TextureCache cache(TextureLoader::shared());
+  return cache;
+}
+
+unsigned int TextureCache::acquire(const std::string &path,
+                                   const SamplerSettings &sampler) {
+  Key key(canonical_path(path), sampler);
+  auto it = entries.find(key);
+  if (it != entries.end()) {
+    stats.hits++;
+    it->second.references++;
+    return it->second.id;
+  }
+
+  stats.misses++;
+  stats.textures++;
+  unsigned int id =
+      loader.load(key.first, sampler, [this, key](const DecodedImage &image) {
+        auto entry = entries.find(key);
+        if (entry == entries.end()) {
+          return;
+        }
+        entry->second.bytes = image.gpu_bytes();
+        stats.resident_bytes += entry->second.bytes;
+      });
+  entries[key] = {id, 1, 0};
+  keys[id] = key;
+  return id;
+}
+
+void TextureCache::retain(unsigned int id) {
+  auto key = keys.find(id);
+  if (key != keys.end()) {
+    entries[key->second].references++;
+  }
+}
+
+void TextureCache::release(unsigned int id) {
+  auto key = keys.find(id);
+  if (key == keys.end()) {
+    return;
+  }
+  auto it = entries.find(key->second);
+  if (--it->second.references > 0) {
+    return;
+  }
+  loader.cancel(id);
+  // Once the window is gone its textures went with it
+  if (glfwGetCurrentContext() != nullptr) {
+    glDeleteTextures(1, &id);
+  }
+  stats.textures--;
+  stats.resident_bytes -= it->second.bytes;
+  entries.erase(it);
+  keys.erase(key);
+}
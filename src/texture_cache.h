@@ -0,0 +1,56 @@
+#pragma once
+
+#include <map>
+#include <string>
+
+#include "texture_loader.h"
+
+// Textures shared by everything in the process. A file is decoded and
+// uploaded once per sampler setting no matter how many models use it;
+// each user holds a reference and the texture is deleted when the last
+// one is released. Files are told apart by their canonical path, so
+// "res/a.png" and "./res/../res/a.png" are the same texture.
+//
+// Loading goes through a TextureLoader, so textures show a placeholder
+// until its pump() uploads them. GL thread only.
+class TextureCache {
+public:
+  struct Stats {
+    long long hits = 0;
+    long long misses = 0;
+    int textures = 0;
+    // Of the textures uploaded so far, see DecodedImage::gpu_bytes()
+    long long resident_bytes = 0;
+  };
+
+  explicit TextureCache(TextureLoader &loader);
+  TextureCache(const TextureCache &) = delete;
+  TextureCache &operator=(const TextureCache &) = delete;
+
+  // The cache for the main window's context, loading through
+  // TextureLoader::shared()
+  static TextureCache &shared();
+
+  // Returns the texture and adds a reference to it
+  unsigned int acquire(const std::string &path,
+                       const SamplerSettings &sampler = SamplerSettings());
+  // Adds a reference to a texture acquired before
+  void retain(unsigned int id);
+  // Drops a reference; the last one deletes the texture
+  void release(unsigned int id);
+
+  const Stats &get_stats() const { return stats; }
+
+private:
+  typedef std::pair<std::string, SamplerSettings> Key;
+  struct Entry {
+    unsigned int id;
+    int references;
+    long long bytes;
+  };
+
+  TextureLoader &loader;
+  std::map<Key, Entry> entries;
+  std::map<unsigned int, Key> keys;
+  Stats stats;
+};
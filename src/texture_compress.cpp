@@ -0,0 +1,619 @@
+#include "texture_compress.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "binary_io.h"
+
+// Mips
+// --------------------------
+
+static Image box_half(const Image &src) {
+  Image dst;
+  dst.width = std::max(1, src.width / 2);
+  dst.height = std::max(1, src.height / 2);
+  dst.channels = src.channels;
+  dst.pixels.resize((size_t)dst.width * dst.height * dst.channels);
+  int c = src.channels;
+  for (int y = 0; y < dst.height; y++) {
+    int y0 = std::min(2 * y, src.height - 1);
+    int y1 = std::min(2 * y + 1, src.height - 1);
+    for (int x = 0; x < dst.width; x++) {
+      int x0 = std::min(2 * x, src.width - 1);
+      int x1 = std::min(2 * x + 1, src.width - 1);
+      for (int k = 0; k < c; k++) {
+        int sum = src.pixels[((size_t)y0 * src.width + x0) * c + k] +
+                  src.pixels[((size_t)y0 * src.width + x1) * c + k] +
+                  src.pixels[((size_t)y1 * src.width + x0) * c + k] +
+                  src.pixels[((size_t)y1 * src.width + x1) * c + k];
+        dst.pixels[((size_t)y * dst.width + x) * c + k] = (sum + 2) / 4;
+      }
+    }
+  }
+  return dst;
+}
+
+// Zeroth order modified Bessel function of the first kind, by its series
+static double bessel_i0(double x) {
+  double sum = 1.0;
+  double term = 1.0;
+  for (int k = 1; k < 32; k++) {
+    term *= (x / (2 * k)) * (x / (2 * k));
+    sum += term;
+  }
+  return sum;
+}
+
+// Taps of a Kaiser windowed sinc that shrinks n samples to m, in units of
+// the destination spacing
+struct FilterTaps {
+  std::vector<int> first;
+  std::vector<std::vector<float>> weights;
+};
+
+static FilterTaps kaiser_taps(int n, int m) {
+  const double radius = 3.0;
+  const double alpha = 4.0;
+  const double pi = 3.14159265358979323846;
+  double scale = (double)n / m;
+  FilterTaps taps;
+  for (int i = 0; i < m; i++) {
+    double center = (i + 0.5) * scale;
+    int lo = (int)std::floor(center - radius * scale);
+    int hi = (int)std::ceil(center + radius * scale);
+    std::vector<float> weights;
+    double total = 0.0;
+    for (int j = lo; j <= hi; j++) {
+      double x = (j + 0.5 - center) / scale;
+      double w = 0.0;
+      if (std::abs(x) < radius) {
+        double t = x / radius;
+        double window =
+            bessel_i0(alpha * std::sqrt(1.0 - t * t)) / bessel_i0(alpha);
+        double sinc = x == 0.0 ? 1.0 : std::sin(pi * x) / (pi * x);
+        w = sinc * window;
+      }
+      weights.push_back((float)w);
+      total += w;
+    }
+    for (float &w : weights) {
+      w = (float)(w / total);
+    }
+    taps.first.push_back(lo);
+    taps.weights.push_back(weights);
+  }
+  return taps;
+}
+
+static Image kaiser_half(const Image &src) {
+  int c = src.channels;
+  int width = std::max(1, src.width / 2);
+  int height = std::max(1, src.height / 2);
+  FilterTaps across = kaiser_taps(src.width, width);
+  FilterTaps down = kaiser_taps(src.height, height);
+
+  // Separable: rows first into floats, then columns
+  std::vector<float> rows((size_t)width * src.height * c);
+  for (int y = 0; y < src.height; y++) {
+    for (int x = 0; x < width; x++) {
+      for (int k = 0; k < c; k++) {
+        float sum = 0.0f;
+        for (size_t t = 0; t < across.weights[x].size(); t++) {
+          int sx = std::min(std::max(across.first[x] + (int)t, 0),
+                            src.width - 1);
+          sum += across.weights[x][t] *
+                 src.pixels[((size_t)y * src.width + sx) * c + k];
+        }
+        rows[((size_t)y * width + x) * c + k] = sum;
+      }
+    }
+  }
+
+  Image dst;
+  dst.width = width;
+  dst.height = height;
+  dst.channels = c;
+  dst.pixels.resize((size_t)width * height * c);
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      for (int k = 0; k < c; k++) {
+        float sum = 0.0f;
+        for (size_t t = 0; t < down.weights[y].size(); t++) {
+          int sy = std::min(std::max(down.first[y] + (int)t, 0),
+                            src.height - 1);
+          sum += down.weights[y][t] * rows[((size_t)sy * width + x) * c + k];
+        }
+        // The negative lobes can overshoot
+        dst.pixels[((size_t)y * width + x) * c + k] =
+            (uint8_t)std::min(std::max(std::lround(sum), 0L), 255L);
+      }
+    }
+  }
+  return dst;
+}
+
+std::vector<Image> build_mips(const Image &base, MipFilter filter) {
+  std::vector<Image> mips;
+  const Image *level = &base;
+  while (level->width > 1 || level->height > 1) {
+    mips.push_back(filter == MipFilter::BOX ? box_half(*level)
+                                            : kaiser_half(*level));
+    level = &mips.back();
+  }
+  return mips;
+}
+
+// Blocks
+// --------------------------
+
+int block_bytes(BlockFormat format) {
+  return format == BlockFormat::BC1 ? 8 : 16;
+}
+
+size_t compressed_size(BlockFormat format, int width, int height) {
+  return (size_t)((width + 3) / 4) * ((height + 3) / 4) * block_bytes(format);
+}
+
+BlockFormat choose_format(const Image &image) {
+  if (image.channels == 2 || image.channels == 4) {
+    int c = image.channels;
+    for (size_t i = c - 1; i < image.pixels.size(); i += c) {
+      if (image.pixels[i] != 255) {
+        return BlockFormat::BC3;
+      }
+    }
+  }
+  return BlockFormat::BC1;
+}
+
+// The 16 texels of a block as RGBA. One and two channel images are grey
+// and grey with alpha, as stb_image gives them.
+static void gather_block(const Image &image, int bx, int by,
+                         uint8_t texels[16][4]) {
+  int c = image.channels;
+  for (int i = 0; i < 16; i++) {
+    int x = std::min(bx * 4 + i % 4, image.width - 1);
+    int y = std::min(by * 4 + i / 4, image.height - 1);
+    const uint8_t *p = &image.pixels[((size_t)y * image.width + x) * c];
+    uint8_t *t = texels[i];
+    if (c == 1) {
+      t[0] = t[1] = t[2] = p[0];
+      t[3] = 255;
+    } else if (c == 2) {
+      t[0] = t[1] = t[2] = p[0];
+      t[3] = p[1];
+    } else {
+      t[0] = p[0];
+      t[1] = p[1];
+      t[2] = p[2];
+      t[3] = c == 4 ? p[3] : 255;
+    }
+  }
+}
+
+static uint16_t to_565(const float color[3]) {
+  int r = (int)std::lround(std::min(std::max(color[0], 0.0f), 255.0f) * 31 /
+                           255.0f);
+  int g = (int)std::lround(std::min(std::max(color[1], 0.0f), 255.0f) * 63 /
+                           255.0f);
+  int b = (int)std::lround(std::min(std::max(color[2], 0.0f), 255.0f) * 31 /
+                           255.0f);
+  return (uint16_t)((r << 11) | (g << 5) | b);
+}
+
+static void from_565(uint16_t value, int color[3]) {
+  int r = (value >> 11) & 31;
+  int g = (value >> 5) & 63;
+  int b = value & 31;
+  color[0] = (r << 3) | (r >> 2);
+  color[1] = (g << 2) | (g >> 4);
+  color[2] = (b << 3) | (b >> 2);
+}
+
+static void color_palette(uint16_t c0, uint16_t c1, bool four_colors,
+                          int palette[4][3]) {
+  from_565(c0, palette[0]);
+  from_565(c1, palette[1]);
+  for (int k = 0; k < 3; k++) {
+    if (four_colors) {
+      palette[2][k] = (2 * palette[0][k] + palette[1][k]) / 3;
+      palette[3][k] = (palette[0][k] + 2 * palette[1][k]) / 3;
+    } else {
+      palette[2][k] = (palette[0][k] + palette[1][k]) / 2;
+      palette[3][k] = 0;
+    }
+  }
+}
+
+// Picks the nearest palette entry for every texel; returns the squared
+// error
+static int color_indices(const uint8_t texels[16][4], uint16_t c0,
+                         uint16_t c1, uint32_t &indices) {
+  int palette[4][3];
+  color_palette(c0, c1, true, palette);
+  indices = 0;
+  int error = 0;
+  for (int i = 0; i < 16; i++) {
+    int best = 0;
+    int best_distance = 1 << 30;
+    for (int p = 0; p < 4; p++) {
+      int distance = 0;
+      for (int k = 0; k < 3; k++) {
+        int d = texels[i][k] - palette[p][k];
+        distance += d * d;
+      }
+      if (distance < best_distance) {
+        best = p;
+        best_distance = distance;
+      }
+    }
+    indices |= (uint32_t)best << (2 * i);
+    error += best_distance;
+  }
+  return error;
+}
+
+// Least squares endpoints for the given indices, which fixes most of the
+// error of taking the extremes along the principal axis
+static bool refit_endpoints(const uint8_t texels[16][4], uint32_t indices,
+                            float e0[3], float e1[3]) {
+  static const float weight0[4] = {1.0f, 0.0f, 2.0f / 3, 1.0f / 3};
+  float aa = 0, ab = 0, bb = 0;
+  float ax[3] = {0, 0, 0};
+  float bx[3] = {0, 0, 0};
+  for (int i = 0; i < 16; i++) {
+    float a = weight0[(indices >> (2 * i)) & 3];
+    float b = 1.0f - a;
+    aa += a * a;
+    ab += a * b;
+    bb += b * b;
+    for (int k = 0; k < 3; k++) {
+      ax[k] += a * texels[i][k];
+      bx[k] += b * texels[i][k];
+    }
+  }
+  float det = aa * bb - ab * ab;
+  if (std::abs(det) < 1e-6f) {
+    return false;
+  }
+  for (int k = 0; k < 3; k++) {
+    e0[k] = (ax[k] * bb - bx[k] * ab) / det;
+    e1[k] = (bx[k] * aa - ax[k] * ab) / det;
+  }
+  return true;
+}
+
+// Always in four color mode (c0 > c1), as BC3 requires
+static void encode_color_block(const uint8_t texels[16][4], uint8_t *out) {
+  float mean[3] = {0, 0, 0};
+  for (int i = 0; i < 16; i++) {
+    for (int k = 0; k < 3; k++) {
+      mean[k] += texels[i][k] / 16.0f;
+    }
+  }
+  float cov[6] = {0, 0, 0, 0, 0, 0};
+  for (int i = 0; i < 16; i++) {
+    float d[3] = {texels[i][0] - mean[0], texels[i][1] - mean[1],
+                  texels[i][2] - mean[2]};
+    cov[0] += d[0] * d[0];
+    cov[1] += d[0] * d[1];
+    cov[2] += d[0] * d[2];
+    cov[3] += d[1] * d[1];
+    cov[4] += d[1] * d[2];
+    cov[5] += d[2] * d[2];
+  }
+  // Principal axis by power iteration
+  float axis[3] = {1.0f, 1.0f, 1.0f};
+  for (int iteration = 0; iteration < 8; iteration++) {
+    float next[3] = {cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2],
+                     cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2],
+                     cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2]};
+    float length = std::sqrt(next[0] * next[0] + next[1] * next[1] +
+                             next[2] * next[2]);
+    if (length < 1e-6f) {
+      break;
+    }
+    for (int k = 0; k < 3; k++) {
+      axis[k] = next[k] / length;
+    }
+  }
+  float lo = 0.0f;
+  float hi = 0.0f;
+  for (int i = 0; i < 16; i++) {
+    float t = 0.0f;
+    for (int k = 0; k < 3; k++) {
+      t += (texels[i][k] - mean[k]) * axis[k];
+    }
+    lo = std::min(lo, t);
+    hi = std::max(hi, t);
+  }
+  float e0[3];
+  float e1[3];
+  for (int k = 0; k < 3; k++) {
+    e0[k] = mean[k] + hi * axis[k];
+    e1[k] = mean[k] + lo * axis[k];
+  }
+
+  uint16_t c0 = to_565(e0);
+  uint16_t c1 = to_565(e1);
+  uint32_t indices;
+  int error = color_indices(texels, std::max(c0, c1), std::min(c0, c1),
+                            indices);
+  if (refit_endpoints(texels, indices, e0, e1)) {
+    uint16_t r0 = to_565(e0);
+    uint16_t r1 = to_565(e1);
+    uint32_t refit_indices;
+    if (r0 != r1 && color_indices(texels, std::max(r0, r1),
+                                  std::min(r0, r1), refit_indices) < error) {
+      c0 = r0;
+      c1 = r1;
+    }
+  }
+  if (c0 < c1) {
+    std::swap(c0, c1);
+  }
+  if (c0 == c1) {
+    // Every texel is the same 565 color
+    indices = 0;
+  } else {
+    color_indices(texels, c0, c1, indices);
+  }
+  std::memcpy(out, &c0, 2);
+  std::memcpy(out + 2, &c1, 2);
+  std::memcpy(out + 4, &indices, 4);
+}
+
+static void alpha_palette(int a0, int a1, int palette[8]) {
+  palette[0] = a0;
+  palette[1] = a1;
+  if (a0 > a1) {
+    for (int k = 2; k < 8; k++) {
+      palette[k] = ((8 - k) * a0 + (k - 1) * a1) / 7;
+    }
+  } else {
+    for (int k = 2; k < 6; k++) {
+      palette[k] = ((6 - k) * a0 + (k - 1) * a1) / 5;
+    }
+    palette[6] = 0;
+    palette[7] = 255;
+  }
+}
+
+// One channel of a block, BC4 style
+static void encode_channel_block(const uint8_t texels[16][4], int channel,
+                                 uint8_t *out) {
+  int a0 = 0;
+  int a1 = 255;
+  for (int i = 0; i < 16; i++) {
+    a0 = std::max(a0, (int)texels[i][channel]);
+    a1 = std::min(a1, (int)texels[i][channel]);
+  }
+  int palette[8];
+  alpha_palette(a0, a1, palette);
+  uint64_t indices = 0;
+  if (a0 > a1) {
+    for (int i = 0; i < 16; i++) {
+      int best = 0;
+      for (int p = 1; p < 8; p++) {
+        if (std::abs(texels[i][channel] - palette[p]) <
+            std::abs(texels[i][channel] - palette[best])) {
+          best = p;
+        }
+      }
+      indices |= (uint64_t)best << (3 * i);
+    }
+  }
+  out[0] = (uint8_t)a0;
+  out[1] = (uint8_t)a1;
+  for (int b = 0; b < 6; b++) {
+    out[2 + b] = (uint8_t)(indices >> (8 * b));
+  }
+}
+
+std::vector<uint8_t> compress(const Image &image, BlockFormat format) {
+  int blocks_x = (image.width + 3) / 4;
+  int blocks_y = (image.height + 3) / 4;
+  int size = block_bytes(format);
+  std::vector<uint8_t> blocks((size_t)blocks_x * blocks_y * size);
+  uint8_t texels[16][4];
+  for (int by = 0; by < blocks_y; by++) {
+    for (int bx = 0; bx < blocks_x; bx++) {
+      uint8_t *out = &blocks[((size_t)by * blocks_x + bx) * size];
+      gather_block(image, bx, by, texels);
+      switch (format) {
+      case BlockFormat::BC1:
+        encode_color_block(texels, out);
+        break;
+      case BlockFormat::BC3:
+        encode_channel_block(texels, 3, out);
+        encode_color_block(texels, out + 8);
+        break;
+      case BlockFormat::BC5:
+        // The first two channels of the image, which gather_block puts in
+        // alpha for two channel images
+        encode_channel_block(texels, 0, out);
+        encode_channel_block(texels, image.channels == 2 ? 3 : 1, out + 8);
+        break;
+      }
+    }
+  }
+  return blocks;
+}
+
+static void decode_channel_block(const uint8_t *in, int channel,
+                                 uint8_t texels[16][4]) {
+  int palette[8];
+  alpha_palette(in[0], in[1], palette);
+  uint64_t indices = 0;
+  for (int b = 0; b < 6; b++) {
+    indices |= (uint64_t)in[2 + b] << (8 * b);
+  }
+  for (int i = 0; i < 16; i++) {
+    texels[i][channel] = (uint8_t)palette[(indices >> (3 * i)) & 7];
+  }
+}
+
+static void decode_color_block(const uint8_t *in, bool always_four,
+                               uint8_t texels[16][4]) {
+  uint16_t c0;
+  uint16_t c1;
+  uint32_t indices;
+  std::memcpy(&c0, in, 2);
+  std::memcpy(&c1, in + 2, 2);
+  std::memcpy(&indices, in + 4, 4);
+  bool four_colors = always_four || c0 > c1;
+  int palette[4][3];
+  color_palette(c0, c1, four_colors, palette);
+  for (int i = 0; i < 16; i++) {
+    int p = (indices >> (2 * i)) & 3;
+    for (int k = 0; k < 3; k++) {
+      texels[i][k] = (uint8_t)palette[p][k];
+    }
+    texels[i][3] = !four_colors && p == 3 ? 0 : 255;
+  }
+}
+
+Image decompress(const std::vector<uint8_t> &blocks, BlockFormat format,
+                 int width, int height) {
+  Image image;
+  image.width = width;
+  image.height = height;
+  image.channels = 4;
+  image.pixels.resize((size_t)width * height * 4);
+  int blocks_x = (width + 3) / 4;
+  int blocks_y = (height + 3) / 4;
+  int size = block_bytes(format);
+  uint8_t texels[16][4];
+  for (int by = 0; by < blocks_y; by++) {
+    for (int bx = 0; bx < blocks_x; bx++) {
+      const uint8_t *in = &blocks[((size_t)by * blocks_x + bx) * size];
+      switch (format) {
+      case BlockFormat::BC1:
+        decode_color_block(in, false, texels);
+        break;
+      case BlockFormat::BC3:
+        decode_color_block(in + 8, true, texels);
+        decode_channel_block(in, 3, texels);
+        break;
+      case BlockFormat::BC5:
+        decode_channel_block(in, 0, texels);
+        decode_channel_block(in + 8, 1, texels);
+        for (int i = 0; i < 16; i++) {
+          texels[i][2] = 0;
+          texels[i][3] = 255;
+        }
+        break;
+      }
+      for (int i = 0; i < 16; i++) {
+        int x = bx * 4 + i % 4;
+        int y = by * 4 + i / 4;
+        if (x < width && y < height) {
+          std::memcpy(&image.pixels[((size_t)y * width + x) * 4], texels[i],
+                      4);
+        }
+      }
+    }
+  }
+  return image;
+}
+
+// Textures and files
+// --------------------------
+
+size_t CompressedTexture::size_bytes() const {
+  size_t size = 0;
+  for (const std::vector<uint8_t> &level : levels) {
+    size += level.size();
+  }
+  return size;
+}
+
+CompressedTexture compress_texture(const Image &image, MipFilter filter) {
+  CompressedTexture texture;
+  texture.format = choose_format(image);
+  texture.width = image.width;
+  texture.height = image.height;
+  texture.levels.push_back(compress(image, texture.format));
+  for (const Image &mip : build_mips(image, filter)) {
+    texture.levels.push_back(compress(mip, texture.format));
+  }
+  return texture;
+}
+
+static const char kTextureMagic[8] = {'C', 'T', 'E', 'X', '\r', '\n',
+                                      '\x1a', '\n'};
+// 2: grey and alpha images are BC3 instead of BC5
+static const uint32_t kTextureVersion = 2;
+
+void write_compressed(std::ostream &out, const CompressedTexture &texture,
+                      uint64_t source_hash) {
+  out.write(kTextureMagic, sizeof(kTextureMagic));
+  write_value(out, kTextureVersion);
+  write_value(out, (uint32_t)texture.format);
+  write_value(out, (uint32_t)texture.width);
+  write_value(out, (uint32_t)texture.height);
+  write_value(out, (uint32_t)texture.levels.size());
+  write_value(out, source_hash);
+  uint64_t offset = sizeof(kTextureMagic) + 5 * sizeof(uint32_t) +
+                    sizeof(uint64_t) +
+                    texture.levels.size() * 2 * sizeof(uint64_t);
+  for (const std::vector<uint8_t> &level : texture.levels) {
+    write_value(out, offset);
+    write_value(out, (uint64_t)level.size());
+    offset += level.size();
+  }
+  for (const std::vector<uint8_t> &level : texture.levels) {
+    out.write((const char *)level.data(), level.size());
+  }
+}
+
+bool read_compressed(std::istream &in, uint64_t source_hash,
+                     CompressedTexture &texture) {
+  char magic[8];
+  uint32_t version = 0, format = 0, width = 0, height = 0, level_count = 0;
+  uint64_t hash = 0;
+  in.read(magic, sizeof(magic));
+  read_value(in, version);
+  read_value(in, format);
+  read_value(in, width);
+  read_value(in, height);
+  read_value(in, level_count);
+  read_value(in, hash);
+  if (!in || std::memcmp(magic, kTextureMagic, sizeof(magic)) != 0 ||
+      version != kTextureVersion || hash != source_hash ||
+      (format != 1 && format != 3 && format != 5) || width == 0 ||
+      height == 0 || width > 16384 || height > 16384) {
+    return false;
+  }
+  uint32_t expected_levels = 1;
+  while ((width >> (expected_levels - 1)) > 1 ||
+         (height >> (expected_levels - 1)) > 1) {
+    expected_levels++;
+  }
+  if (level_count != expected_levels) {
+    return false;
+  }
+
+  texture.format = (BlockFormat)format;
+  texture.width = width;
+  texture.height = height;
+  std::vector<uint64_t> offsets(level_count);
+  texture.levels.assign(level_count, {});
+  for (uint32_t i = 0; i < level_count; i++) {
+    uint64_t size = 0;
+    read_value(in, offsets[i]);
+    read_value(in, size);
+    int w = std::max(1u, width >> i);
+    int h = std::max(1u, height >> i);
+    if (!in || size != compressed_size(texture.format, w, h)) {
+      return false;
+    }
+    texture.levels[i].resize(size);
+  }
+  for (uint32_t i = 0; i < level_count; i++) {
+    in.seekg(offsets[i]);
+    in.read((char *)texture.levels[i].data(), texture.levels[i].size());
+  }
+  return (bool)in;
+}
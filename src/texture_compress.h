@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <vector>
+
+// CPU side of compressed textures: mip chains, block compression and the
+// file they are kept in. Nothing here touches GL.
+
+// An 8 bit image with 1 to 4 channels, rows bottom up
+struct Image {
+  int width = 0;
+  int height = 0;
+  int channels = 0;
+  std::vector<uint8_t> pixels;
+};
+
+enum class MipFilter {
+  BOX,    // average of each 2x2 square, cheap
+  KAISER, // Kaiser windowed sinc, keeps small levels sharper
+};
+
+// Levels 1 and up of the full chain down to 1x1, halving each side
+// (odd sides round down, never below 1). Level 0 is base itself and is
+// not copied.
+std::vector<Image> build_mips(const Image &base, MipFilter filter);
+
+// Block formats, all in 4x4 texel blocks. The values are stored in files.
+enum class BlockFormat : uint32_t {
+  BC1 = 1, // RGB, 8 bytes a block
+  BC3 = 3, // RGBA, 16 bytes a block
+  BC5 = 5, // two channels (e.g. normal map xy), 16 bytes a block. Never
+           // chosen on its own, as two channel files are grey and alpha.
+};
+
+int block_bytes(BlockFormat format);
+size_t compressed_size(BlockFormat format, int width, int height);
+// BC1 for opaque images, BC3 when any alpha is below 255. One and two
+// channel images are taken as grey and grey with alpha.
+BlockFormat choose_format(const Image &image);
+
+// Texels outside the image in the last row and column of blocks repeat
+// the edge. BC5 takes the first two channels of the image.
+std::vector<uint8_t> compress(const Image &image, BlockFormat format);
+// Back to RGBA (BC5 gives red and green, with blue 0 and alpha 255)
+Image decompress(const std::vector<uint8_t> &blocks, BlockFormat format,
+                 int width, int height);
+
+// A compressed texture with its mips, level 0 first
+struct CompressedTexture {
+  BlockFormat format = BlockFormat::BC1;
+  int width = 0;
+  int height = 0;
+  std::vector<std::vector<uint8_t>> levels;
+
+  size_t size_bytes() const;
+};
+
+CompressedTexture compress_texture(const Image &image, MipFilter filter);
+
+// The file is laid out like a KTX2 file without the data format
+// descriptor: a header, an index with the offset and size of every level
+// and the levels themselves. source_hash ties it to the image it was made
+// from; read_compressed() fails if it does not match.
+void write_compressed(std::ostream &out, const CompressedTexture &texture,
+                      uint64_t source_hash);
+bool read_compressed(std::istream &in, uint64_t source_hash,
+                     CompressedTexture &texture);
@@ -0,0 +1,157 @@
+#include "gtest/gtest.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <sstream>
+
+#include "texture_compress.h"
+
+static Image make_image(int width, int height, int channels) {
+  Image image;
+  image.width = width;
+  image.height = height;
+  image.channels = channels;
+  image.pixels.resize((size_t)width * height * channels);
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      uint8_t *p = &image.pixels[((size_t)y * width + x) * channels];
+      // Smooth gradients plus a little noise, like a photo
+      int noise = std::rand() % 9 - 4;
+      for (int k = 0; k < channels; k++) {
+        int value = k == 0 ? x * 255 / width
+                    : k == 1 ? y * 255 / height
+                    : k == 2 ? (x + y) * 127 / (width + height) + 64
+                             : 255 - x * 200 / width;
+        p[k] = (uint8_t)std::min(std::max(value + noise, 0), 255);
+      }
+    }
+  }
+  return image;
+}
+
+// Root mean square error over the first channels of both images
+static double rms_error(const Image &a, const Image &b, int channels) {
+  double sum = 0.0;
+  for (int i = 0; i < a.width * a.height; i++) {
+    for (int k = 0; k < channels; k++) {
+      double d = a.pixels[i * a.channels + k] - b.pixels[i * b.channels + k];
+      sum += d * d;
+    }
+  }
+  return std::sqrt(sum / (a.width * a.height * channels));
+}
+
+TEST(MipTest, ChainHalvesDownToOneTexel) {
+  Image image = make_image(20, 6, 3);
+  for (MipFilter filter : {MipFilter::BOX, MipFilter::KAISER}) {
+    std::vector<Image> mips = build_mips(image, filter);
+    ASSERT_EQ(mips.size(), 4u);
+    EXPECT_EQ(mips[0].width, 10);
+    EXPECT_EQ(mips[0].height, 3);
+    EXPECT_EQ(mips[1].width, 5);
+    EXPECT_EQ(mips[1].height, 1);
+    EXPECT_EQ(mips[3].width, 1);
+    EXPECT_EQ(mips[3].height, 1);
+  }
+}
+
+TEST(MipTest, FiltersKeepFlatImagesFlat) {
+  Image image;
+  image.width = 16;
+  image.height = 16;
+  image.channels = 2;
+  image.pixels.assign(16 * 16 * 2, 77);
+  for (MipFilter filter : {MipFilter::BOX, MipFilter::KAISER}) {
+    for (const Image &mip : build_mips(image, filter)) {
+      for (uint8_t p : mip.pixels) {
+        ASSERT_EQ(p, 77);
+      }
+    }
+  }
+}
+
+TEST(BlockCompressionTest, RoundTripsWithinTolerance) {
+  Image rgb = make_image(37, 21, 3);
+  Image rgba = make_image(32, 32, 4);
+  Image rg = make_image(16, 12, 2);
+  ASSERT_EQ(choose_format(rgb), BlockFormat::BC1);
+  ASSERT_EQ(choose_format(rgba), BlockFormat::BC3);
+  // Two channels are grey and alpha; BC5 is only used when asked for
+  ASSERT_EQ(choose_format(rg), BlockFormat::BC3);
+
+  std::vector<uint8_t> bc1 = compress(rgb, BlockFormat::BC1);
+  EXPECT_EQ(bc1.size(), compressed_size(BlockFormat::BC1, 37, 21));
+  EXPECT_LT(rms_error(rgb, decompress(bc1, BlockFormat::BC1, 37, 21), 3),
+            6.0);
+
+  Image bc3 = decompress(compress(rgba, BlockFormat::BC3), BlockFormat::BC3,
+                         32, 32);
+  EXPECT_LT(rms_error(rgba, bc3, 3), 6.0);
+  int alpha_error = 0;
+  for (int i = 0; i < 32 * 32; i++) {
+    int d = std::abs(rgba.pixels[i * 4 + 3] - bc3.pixels[i * 4 + 3]);
+    alpha_error = std::max(alpha_error, d);
+  }
+  EXPECT_LT(alpha_error, 12);
+
+  Image bc5 =
+      decompress(compress(rg, BlockFormat::BC5), BlockFormat::BC5, 16, 12);
+  EXPECT_LT(rms_error(rg, bc5, 2), 3.0);
+
+  Image grey_alpha =
+      decompress(compress(rg, BlockFormat::BC3), BlockFormat::BC3, 16, 12);
+  double sum = 0.0;
+  for (int i = 0; i < 16 * 12; i++) {
+    const uint8_t *p = &grey_alpha.pixels[i * 4];
+    int grey = rg.pixels[i * 2];
+    int alpha = rg.pixels[i * 2 + 1];
+    sum += (p[0] - grey) * (p[0] - grey) + (p[2] - grey) * (p[2] - grey) +
+           (p[3] - alpha) * (p[3] - alpha);
+  }
+  EXPECT_LT(std::sqrt(sum / (16 * 12 * 3)), 6.0);
+}
+
+TEST(BlockCompressionTest, SolidBlocksAreExact) {
+  Image image;
+  image.width = 8;
+  image.height = 8;
+  image.channels = 3;
+  for (int i = 0; i < 64; i++) {
+    // Colors 565 can hold exactly
+    image.pixels.insert(image.pixels.end(), {255, 0, 132});
+  }
+  Image decoded = decompress(compress(image, BlockFormat::BC1),
+                             BlockFormat::BC1, 8, 8);
+  EXPECT_EQ(rms_error(image, decoded, 3), 0.0);
+}
+
+TEST(CompressedTextureTest, FileRoundTrips) {
+  Image image = make_image(64, 32, 4);
+  CompressedTexture texture = compress_texture(image, MipFilter::KAISER);
+  ASSERT_EQ(texture.levels.size(), 7u);
+  EXPECT_EQ(texture.levels.back().size(), 16u);
+  // BC3 is a byte per texel, a quarter of RGBA8
+  EXPECT_EQ(texture.levels[0].size(), 64u * 32u);
+
+  std::stringstream file;
+  write_compressed(file, texture, 1234);
+  std::string bytes = file.str();
+
+  CompressedTexture read;
+  std::stringstream good(bytes);
+  ASSERT_TRUE(read_compressed(good, 1234, read));
+  EXPECT_EQ(read.format, texture.format);
+  EXPECT_EQ(read.width, 64);
+  EXPECT_EQ(read.height, 32);
+  EXPECT_EQ(read.levels, texture.levels);
+
+  std::stringstream stale(bytes);
+  EXPECT_FALSE(read_compressed(stale, 4321, read));
+  std::stringstream truncated(bytes.substr(0, bytes.size() - 1));
+  EXPECT_FALSE(read_compressed(truncated, 1234, read));
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
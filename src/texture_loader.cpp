@@ -0,0 +1,206 @@
+#include "texture_loader.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <GL/glew.h>
+
+#include "mesh_cache.h"
+#include "stb_image.h"
+
+DecodedImage decode_image(const std::string &path) {
+  DecodedImage image;
+  // Per thread, so workers never race on stb_image's global setting
+  stbi_set_flip_vertically_on_load_thread(1);
+  image.pixels.reset(stbi_load(path.c_str(), &image.width, &image.height,
+                               &image.channels, 0));
+  return image;
+}
+
+long long DecodedImage::gpu_bytes() const {
+  if (!compressed.levels.empty()) {
+    return compressed.size_bytes();
+  }
+  return (long long)width * height * 4 * 4 / 3;
+}
+
+DecodedImage load_compressed_image(const std::string &path) {
+  uint64_t hash = hash_file(path);
+  std::string cache_path = path + ".ctex";
+  DecodedImage image;
+  std::ifstream in(cache_path, std::ios::binary);
+  if (hash != 0 && in && read_compressed(in, hash, image.compressed)) {
+    image.width = image.compressed.width;
+    image.height = image.compressed.height;
+    return image;
+  }
+
+  image = decode_image(path);
+  if (!image.pixels) {
+    return image;
+  }
+  Image source;
+  source.width = image.width;
+  source.height = image.height;
+  source.channels = image.channels;
+  source.pixels.assign(image.pixels.get(),
+                       image.pixels.get() + (size_t)image.width *
+                                                image.height * image.channels);
+  image.pixels.reset();
+  image.compressed = compress_texture(source, MipFilter::KAISER);
+
+  // Through a temporary file, as other loads may read the cache meanwhile.
+  // Its name is unique, since the same image can be loaded with several
+  // sampler settings at once and each load writes its own copy.
+  std::string temp_path = cache_path + ".XXXXXX";
+  int fd = mkstemp(&temp_path[0]);
+  if (fd < 0) {
+    return image;
+  }
+  // mkstemp makes it private to us; the cache is not
+  fchmod(fd, 0644);
+  close(fd);
+  std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+  write_compressed(out, image.compressed, hash);
+  out.close();
+  if (!out || std::rename(temp_path.c_str(), cache_path.c_str()) != 0) {
+    std::remove(temp_path.c_str());
+  }
+  return image;
+}
+
+static GLenum compressed_format(BlockFormat format) {
+  switch (format) {
+  case BlockFormat::BC1:
+    return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+  case BlockFormat::BC3:
+    return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+  case BlockFormat::BC5:
+    return GL_COMPRESSED_RG_RGTC2;
+  }
+  return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+}
+
+void upload_image(unsigned int id, const DecodedImage &image) {
+  static const GLenum formats[] = {GL_RED, GL_RED, GL_RG, GL_RGB, GL_RGBA};
+  static const GLint internal_formats[] = {GL_R8, GL_R8, GL_RG8, GL_RGB8,
+                                           GL_RGBA8};
+  // Grey and grey with alpha images sample as grey, like their compressed
+  // versions, which hold them as RGB(A)
+  static const GLint swizzles[][4] = {
+      {GL_RED, GL_RED, GL_RED, GL_ONE},
+      {GL_RED, GL_RED, GL_RED, GL_ONE},
+      {GL_RED, GL_RED, GL_RED, GL_GREEN},
+      {GL_RED, GL_GREEN, GL_BLUE, GL_ONE},
+      {GL_RED, GL_GREEN, GL_BLUE, GL_ALPHA},
+  };
+  glBindTexture(GL_TEXTURE_2D, id);
+  const CompressedTexture &compressed = image.compressed;
+  if (!compressed.levels.empty()) {
+    glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzles[4]);
+    // The mips come with the image
+    for (size_t i = 0; i < compressed.levels.size(); i++) {
+      glCompressedTexImage2D(
+          GL_TEXTURE_2D, i, compressed_format(compressed.format),
+          std::max(1, compressed.width >> i),
+          std::max(1, compressed.height >> i), 0,
+          compressed.levels[i].size(), compressed.levels[i].data());
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL,
+                    compressed.levels.size() - 1);
+    return;
+  }
+  // Rows of RGB images need not be 4 byte aligned
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA,
+                   swizzles[image.channels]);
+  glTexImage2D(GL_TEXTURE_2D, 0, internal_formats[image.channels],
+               image.width, image.height, 0, formats[image.channels],
+               GL_UNSIGNED_BYTE, image.pixels.get());
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  glGenerateMipmap(GL_TEXTURE_2D);
+}
+
+TextureLoader::TextureLoader(int num_threads) : pool(num_threads) {}
+
+TextureLoader &TextureLoader::shared() {
+  static TextureLoader loader;
+  return loader;
+}
+
+unsigned int
+TextureLoader::load(const std::string &path, const SamplerSettings &sampler,
+                    std::function<void(const DecodedImage &)> on_upload) {
+  static const unsigned char grey[3] = {128, 128, 128};
+  unsigned int id;
+  glGenTextures(1, &id);
+  glBindTexture(GL_TEXTURE_2D, id);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, sampler.wrap_s);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, sampler.wrap_t);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, sampler.min_filter);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, sampler.mag_filter);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 1, 1, 0, GL_RGB, GL_UNSIGNED_BYTE,
+               grey);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+  bool compress = compression;
+  pending.push_back({id, path, pool.submit([path, compress] {
+                       return compress ? load_compressed_image(path)
+                                       : decode_image(path);
+                     }),
+                     std::move(on_upload)});
+  return id;
+}
+
+void TextureLoader::cancel(unsigned int id) {
+  // The decode still runs; its result is thrown away
+  for (auto it = pending.begin(); it != pending.end(); ++it) {
+    if (it->id == id) {
+      pending.erase(it);
+      return;
+    }
+  }
+}
+
+void TextureLoader::upload(Pending &texture) {
+  DecodedImage image = texture.image.get();
+  if (!image.empty()) {
+    upload_image(texture.id, image);
+    if (texture.on_upload) {
+      texture.on_upload(image);
+    }
+  } else {
+    // Keeps the placeholder
+    printf("Failed to load texture %s.\n", texture.path.c_str());
+  }
+}
+
+int TextureLoader::pump(int max_uploads) {
+  int uploads = 0;
+  auto it = pending.begin();
+  while (it != pending.end() && uploads < max_uploads) {
+    if (it->image.wait_for(std::chrono::seconds(0)) !=
+        std::future_status::ready) {
+      ++it;
+      continue;
+    }
+    upload(*it);
+    it = pending.erase(it);
+    uploads++;
+  }
+  return (int)pending.size();
+}
+
+void TextureLoader::finish() {
+  for (Pending &texture : pending) {
+    upload(texture);
+  }
+  pending.clear();
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <tuple>
+
+#include <GL/glew.h>
+
+#include "texture_compress.h"
+#include "thread_pool.h"
+
+// Pixels of an image file as stb_image decodes them, flipped so the first
+// row is the bottom one as GL expects, or the block compressed version of
+// them. pixels is null (and compressed empty) if the file could not be
+// decoded.
+struct DecodedImage {
+  int width = 0;
+  int height = 0;
+  int channels = 0;
+  std::unique_ptr<unsigned char, void (*)(void *)> pixels{nullptr, free};
+  // Used instead of pixels when it has levels
+  CompressedTexture compressed;
+
+  bool empty() const { return !pixels && compressed.levels.empty(); }
+  // Video memory once uploaded; uncompressed images are assumed to take 4
+  // bytes per texel plus a third for the mipmaps
+  long long gpu_bytes() const;
+};
+
+// How a texture is sampled, set once when it is created
+struct SamplerSettings {
+  GLint wrap_s = GL_REPEAT;
+  GLint wrap_t = GL_REPEAT;
+  GLint min_filter = GL_LINEAR;
+  GLint mag_filter = GL_LINEAR;
+
+  bool operator<(const SamplerSettings &o) const {
+    return std::tie(wrap_s, wrap_t, min_filter, mag_filter) <
+           std::tie(o.wrap_s, o.wrap_t, o.min_filter, o.mag_filter);
+  }
+};
+
+// Safe to call from any thread
+DecodedImage decode_image(const std::string &path);
+// Like decode_image, but block compressed with its mips. The result is
+// kept next to the file as path + ".ctex" and read from there as long as
+// the file does not change.
+DecodedImage load_compressed_image(const std::string &path);
+// Replaces the image of texture id and builds its mipmaps. Needs the GL
+// context.
+void upload_image(unsigned int id, const DecodedImage &image);
+
+// Loads textures without stalling the GL thread. load() hands out the
+// texture id right away and decodes the file on a worker; pump() uploads
+// finished images a few at a time, once per frame. Everything but the
+// decoding happens on the GL thread.
+class TextureLoader {
+public:
+  explicit TextureLoader(int num_threads = 0);
+  TextureLoader(const TextureLoader &) = delete;
+  TextureLoader &operator=(const TextureLoader &) = delete;
+
+  // The loader for the main window's context
+  static TextureLoader &shared();
+
+  // Whether later loads go through load_compressed_image. On by default;
+  // turn it off if the GL lacks S3TC.
+  void set_compression(bool on) { compression = on; }
+
+  // The texture shows a 1x1 grey placeholder until its image is uploaded.
+  // on_upload is called on the GL thread right after the upload.
+  unsigned int
+  load(const std::string &path,
+       const SamplerSettings &sampler = SamplerSettings(),
+       std::function<void(const DecodedImage &)> on_upload = nullptr);
+  // Forgets a texture that is still loading, so it can be deleted
+  void cancel(unsigned int id);
+  // Uploads at most max_uploads images that finished decoding, oldest
+  // first, and returns how many textures are still on their way
+  int pump(int max_uploads);
+  // Waits for and uploads everything that is still on its way
+  void finish();
+
+  int get_pending() const { return (int)pending.size(); }
+
+private:
+  struct Pending {
+    unsigned int id;
+    std::string path;
+    std::future<DecodedImage> image;
+    std::function<void(const DecodedImage &)> on_upload;
+  };
+
+  ThreadPool pool;
+  std::deque<Pending> pending;
+  bool compression = true;
+
+  void upload(Pending &texture);
+};
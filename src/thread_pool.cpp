@@ -0,0 +1,132 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(int num_threads) {
+  if (num_threads <= 0) {
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  for (int i = 1; i < num_threads; i++) {
+    workers.emplace_back(&ThreadPool::worker_loop, this);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  work_cv.notify_all();
+  for (std::thread &t : workers) {
+    t.join();
+  }
+}
+
+void ThreadPool::parallel_for(int begin, int end,
+                              const std::function<void(int, int)> &fn) {
+  parallel_for(begin, end, size(), fn);
+}
+
+void ThreadPool::parallel_for(int begin, int end, int bands,
+                              const std::function<void(int, int)> &fn) {
+  bands = std::min(bands, end - begin);
+  if (bands <= 0) {
+    return;
+  }
+  if (bands == 1 || workers.empty()) {
+    fn(begin, end);
+    return;
+  }
+
+  Job job;
+  job.fn = &fn;
+  job.begin = begin;
+  job.end = end;
+  job.bands = bands;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    jobs.push_back(&job);
+  }
+  work_cv.notify_all();
+
+  while (run_band(job)) {
+  }
+
+  // Once the job is out of the queue and no worker still holds it, it is
+  // safe to let it go out of scope.
+  std::unique_lock<std::mutex> lock(mutex);
+  remove_job(&job);
+  done_cv.wait(lock, [&] {
+    return job.done.load() == job.bands && job.active == 0;
+  });
+}
+
+bool ThreadPool::run_band(Job &job) {
+  int band = job.next.fetch_add(1);
+  if (band >= job.bands) {
+    return false;
+  }
+  long long count = job.end - job.begin;
+  int lo = job.begin + (int)(count * band / job.bands);
+  int hi = job.begin + (int)(count * (band + 1) / job.bands);
+  (*job.fn)(lo, hi);
+  job.done.fetch_add(1);
+  return true;
+}
+
+void ThreadPool::remove_job(Job *job) {
+  auto it = std::find(jobs.begin(), jobs.end(), job);
+  if (it != jobs.end()) {
+    jobs.erase(it);
+  }
+}
+
+void ThreadPool::enqueue(std::function<void()> task) {
+  if (workers.empty()) {
+    task();
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    tasks.push_back(std::move(task));
+  }
+  work_cv.notify_one();
+}
+
+void ThreadPool::worker_loop() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    work_cv.wait(lock, [&] {
+      return stopping || !jobs.empty() || !tasks.empty();
+    });
+    if (stopping) {
+      return;
+    }
+
+    if (jobs.empty()) {
+      std::function<void()> task = std::move(tasks.front());
+      tasks.pop_front();
+      lock.unlock();
+      task();
+      lock.lock();
+      continue;
+    }
+
+    Job *job = jobs.front();
+    if (job->next.load() >= job->bands) {
+      // Every band has been handed out already
+      jobs.pop_front();
+      continue;
+    }
+    job->active++;
+    lock.unlock();
+
+    while (run_band(*job)) {
+    }
+
+    lock.lock();
+    job->active--;
+    remove_job(job);
+    done_cv.notify_all();
+  }
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of worker threads that stay alive for the lifetime of the pool
+// and pick up work handed to parallel_for or submit.
+class ThreadPool {
+public:
+  // num_threads counts the calling thread too, so ThreadPool(4) spawns three
+  // workers. Zero or less picks the number of hardware threads.
+  explicit ThreadPool(int num_threads = 0);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  int size() const { return (int)workers.size() + 1; }
+
+  // Splits [begin, end) into contiguous bands and calls fn(band_begin,
+  // band_end) once per band, blocking until all of them have run. The calling
+  // thread works on bands as well, so parallel_for may be called from inside
+  // another parallel_for without deadlocking.
+  void parallel_for(int begin, int end,
+                    const std::function<void(int, int)> &fn);
+  void parallel_for(int begin, int end, int bands,
+                    const std::function<void(int, int)> &fn);
+
+  // Runs fn() on a worker in the background and returns its result
+  // through the future. Bands of parallel_for go first, so tasks only use
+  // workers that have nothing else to do. A pool without workers runs fn
+  // right away. Tasks still queued when the pool goes away are dropped
+  // and their futures report a broken promise.
+  template <typename F>
+  std::future<typename std::result_of<F()>::type> submit(F fn) {
+    typedef typename std::result_of<F()>::type Result;
+    auto task = std::make_shared<std::packaged_task<Result()>>(std::move(fn));
+    std::future<Result> result = task->get_future();
+    enqueue([task] { (*task)(); });
+    return result;
+  }
+
+private:
+  struct Job {
+    const std::function<void(int, int)> *fn;
+    int begin;
+    int end;
+    int bands;
+    std::atomic<int> next{0};
+    std::atomic<int> done{0};
+    int active = 0; // workers holding a pointer to this job, guarded by mutex
+  };
+
+  bool run_band(Job &job);
+  void remove_job(Job *job);
+  void enqueue(std::function<void()> task);
+  void worker_loop();
+
+  std::vector<std::thread> workers;
+  std::deque<Job *> jobs;
+  std::deque<std::function<void()>> tasks;
+  std::mutex mutex;
+  std::condition_variable work_cv;
+  std::condition_variable done_cv;
+  bool stopping = false;
+};
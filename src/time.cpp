@@ -79,3 +79,59 @@ int Timer::passed() {
   _passed = 0;
   return result;
 }
+
+
+FixedStepScheduler& FixedStepScheduler::setStepMillis(double step_msecs) {
+  if (step_msecs > 0) {
+    _step_msecs = step_msecs;
+  }
+  return *this;
+}
+double FixedStepScheduler::getStepMillis() {
+  return _step_msecs;
+}
+double FixedStepScheduler::getStepSecs() {
+  return _step_msecs / 1000;
+}
+
+FixedStepScheduler& FixedStepScheduler::setMaxCatchUpSteps(int steps) {
+  _max_catch_up_steps = steps < 1 ? 1 : steps;
+  return *this;
+}
+int FixedStepScheduler::getMaxCatchUpSteps() {
+  return _max_catch_up_steps;
+}
+
+int FixedStepScheduler::tickWithClock(IClock& clock) {
+  return tickWithTime(clock.getTimeMillis());
+}
+
+int FixedStepScheduler::tickWithTime(double time_msecs) {
+  // The first tick only sets the starting point
+  if (!_started) {
+    _started = true;
+    _last_time_msecs = time_msecs;
+    return 0;
+  }
+  double delta = time_msecs - _last_time_msecs;
+  _last_time_msecs = time_msecs;
+  if (delta > 0) {
+    _accumulated_msecs += delta;
+  }
+
+  int steps = (int)(_accumulated_msecs / _step_msecs);
+  if (steps > _max_catch_up_steps) {
+    double excess = (steps - _max_catch_up_steps) * _step_msecs;
+    _dropped_msecs += excess;
+    _accumulated_msecs -= excess;
+    steps = _max_catch_up_steps;
+  }
+  _accumulated_msecs -= steps * _step_msecs;
+  _simulated_msecs += steps * _step_msecs;
+  return steps;
+}
+
+double FixedStepScheduler::alpha() {
+  double a = _accumulated_msecs / _step_msecs;
+  return a < 0 ? 0 : (a > 1 ? 1 : a);
+}
@@ -65,3 +65,38 @@ protected:
 
   int _passed = 0;
 };
+
+// Runs a simulation in fixed steps. Every tick adds the time elapsed on the
+// clock to an accumulator and returns how many whole steps are due, at most
+// getMaxCatchUpSteps(); time beyond that is dropped so one long stall does
+// not turn into a burst of steps that takes even longer. alpha() is how far
+// the leftover time reaches into the next step, for blending render state
+// between the last two steps.
+class FixedStepScheduler {
+public:
+  FixedStepScheduler &setStepMillis(double step_msecs);
+  double getStepMillis();
+  double getStepSecs();
+  FixedStepScheduler &setMaxCatchUpSteps(int steps);
+  int getMaxCatchUpSteps();
+
+  int tickWithTime(double time_msecs);
+  int tickWithClock(IClock &clock);
+
+  double alpha();
+  // Total time covered by the steps handed out so far
+  double getSimulatedMillis() { return _simulated_msecs; }
+  double getSimulatedSecs() { return _simulated_msecs / 1000; }
+  // Time thrown away because of the catch-up cap
+  double getDroppedMillis() { return _dropped_msecs; }
+
+protected:
+  double _step_msecs = 1000 / 60.0;
+  int _max_catch_up_steps = 5;
+
+  bool _started = false;
+  double _last_time_msecs = 0;
+  double _accumulated_msecs = 0;
+  double _simulated_msecs = 0;
+  double _dropped_msecs = 0;
+};
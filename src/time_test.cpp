@@ -0,0 +1,30 @@
+#include "gtest/gtest.h"
+
+#include "time.h"
+
+TEST(FixedStepSchedulerTest, RunsAllDueSteps) {
+  FixedStepScheduler scheduler;
+  scheduler.setStepMillis(10).setMaxCatchUpSteps(5);
+  EXPECT_EQ(scheduler.tickWithTime(100), 0);
+  EXPECT_EQ(scheduler.tickWithTime(104), 0);
+  EXPECT_DOUBLE_EQ(scheduler.alpha(), 0.4);
+  EXPECT_EQ(scheduler.tickWithTime(135), 3);
+  EXPECT_DOUBLE_EQ(scheduler.alpha(), 0.5);
+  EXPECT_DOUBLE_EQ(scheduler.getSimulatedMillis(), 30);
+}
+
+TEST(FixedStepSchedulerTest, CapsCatchUpSteps) {
+  FixedStepScheduler scheduler;
+  scheduler.setStepMillis(10).setMaxCatchUpSteps(4);
+  scheduler.tickWithTime(0);
+  EXPECT_EQ(scheduler.tickWithTime(1005), 4);
+  EXPECT_DOUBLE_EQ(scheduler.getDroppedMillis(), 960);
+  EXPECT_DOUBLE_EQ(scheduler.alpha(), 0.5);
+  EXPECT_EQ(scheduler.tickWithTime(1010), 1);
+  EXPECT_DOUBLE_EQ(scheduler.getSimulatedMillis(), 50);
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <atomic>
+
+// Hands complete values from one writer thread to one reader thread without
+// locks or blocking. The writer fills write_buffer() and publishes it; the
+// reader calls update() whenever it wants the newest published value and
+// then reads read_buffer(). Values the reader never picked up are simply
+// overwritten, so a slow reader only ever sees the latest one.
+//
+// Of the three buffers the writer owns one, the reader owns one and the
+// third is parked in `middle` together with a flag saying whether it holds
+// something the reader has not seen yet. Both sides only ever swap their
+// own buffer with the parked one.
+template <typename T> class TripleBuffer {
+public:
+  TripleBuffer() = default;
+  TripleBuffer(const TripleBuffer &) = delete;
+  TripleBuffer &operator=(const TripleBuffer &) = delete;
+
+  // Writer side
+  T &write_buffer() { return buffers[write_index]; }
+  void publish() {
+    int previous = middle.exchange(write_index | kFresh,
+                                   std::memory_order_acq_rel);
+    write_index = previous & kIndexMask;
+  }
+
+  // Reader side. Returns true when a newer value was taken.
+  bool update() {
+    if ((middle.load(std::memory_order_relaxed) & kFresh) == 0) {
+      return false;
+    }
+    int previous = middle.exchange(read_index, std::memory_order_acq_rel);
+    read_index = previous & kIndexMask;
+    return true;
+  }
+  const T &read_buffer() const { return buffers[read_index]; }
+  T &read_buffer() { return buffers[read_index]; }
+
+private:
+  static const int kIndexMask = 3;
+  static const int kFresh = 4;
+
+  T buffers[3];
+  int write_index = 0;
+  int read_index = 1;
+  std::atomic<int> middle{2};
+};